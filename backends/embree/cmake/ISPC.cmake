@@ -17,6 +17,11 @@ function(add_ispc_library)
 
     if (${CMAKE_SYSTEM_PROCESSOR} STREQUAL "AMD64" OR ${CMAKE_SYSTEM_PROCESSOR} STREQUAL "x86_64")
         set(ISPC_ARCH "x86-64")
+        # Compile for each target and let ISPC dispatch to the best one supported at runtime
+        set(ISPC_TARGETS "sse4-i32x4;avx2-i32x8;avx512skx-i32x16" CACHE STRING
+            "ISPC targets to compile for on x86-64, dispatched between at runtime")
+        string(REPLACE ";" "," ISPC_TARGET_LIST "${ISPC_TARGETS}")
+        set(ISPC_TARGET_ARG "--target=${ISPC_TARGET_LIST}")
     elseif (${CMAKE_SYSTEM_PROCESSOR} STREQUAL "arm64")
         set(ISPC_TARGET_ARG "--target=neon-i32x4")
         set(ISPC_ARCH "aarch64")
@@ -33,7 +38,18 @@ function(add_ispc_library)
         # First build the list of dependencies of the ISPC file to
         # populate its actual dependencies list
         get_filename_component(FNAME ${SRC} NAME_WE)
-        list(APPEND ISPC_OBJS ${CMAKE_CURRENT_BINARY_DIR}/${FNAME}.o)
+        set(SRC_OBJS ${CMAKE_CURRENT_BINARY_DIR}/${FNAME}.o)
+
+        # With multiple targets ISPC writes an object for each target, suffixed with its ISA,
+        # along with the dispatch object
+        list(LENGTH ISPC_TARGETS NUM_TARGETS)
+        if (NUM_TARGETS GREATER 1)
+            foreach (TARGET ${ISPC_TARGETS})
+                string(REGEX REPLACE "-.*" "" TARGET_ISA ${TARGET})
+                list(APPEND SRC_OBJS ${CMAKE_CURRENT_BINARY_DIR}/${FNAME}_${TARGET_ISA}.o)
+            endforeach()
+        endif()
+        list(APPEND ISPC_OBJS ${SRC_OBJS})
 
         message("Writing ISPC dependency list for ${SRC} to ${CMAKE_CURRENT_BINARY_DIR}/${FNAME}.idep")
         execute_process(
@@ -58,7 +74,7 @@ function(add_ispc_library)
         endif()
 
         add_custom_command(OUTPUT
-            ${CMAKE_CURRENT_BINARY_DIR}/${FNAME}.o
+            ${SRC_OBJS}
             ${CMAKE_CURRENT_BINARY_DIR}/${FNAME}_ispc.h
             COMMAND ${ispc} ${CMAKE_CURRENT_LIST_DIR}/${SRC}
             -o ${CMAKE_CURRENT_BINARY_DIR}/${FNAME}.o
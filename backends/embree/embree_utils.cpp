@@ -2,29 +2,76 @@
 #include <algorithm>
 #include <iterator>
 #include <limits>
+#include <stdexcept>
 #include <glm/ext.hpp>
 
 namespace embree {
 
+// Return the external buffer if it can be shared and keep its owner alive, otherwise copy
+// the attribute into buf and return the copy. Returns null for empty attributes
+template <typename T>
+static const T *share_or_copy(const AttributeBuffer<T> &attrib,
+                              const bool share_external,
+                              std::vector<T> &buf,
+                              std::vector<std::shared_ptr<const void>> &owners)
+{
+    if (attrib.empty()) {
+        return nullptr;
+    }
+    if (share_external && attrib.is_external()) {
+        owners.push_back(attrib.owner());
+        return attrib.data();
+    }
+    buf = std::vector<T>(attrib.begin(), attrib.end());
+    return buf.data();
+}
+
 Geometry::Geometry(RTCDevice &device,
-                   const std::vector<glm::vec3> &verts,
-                   const std::vector<glm::uvec3> &indices,
-                   const std::vector<glm::vec3> &normals,
-                   const std::vector<glm::vec2> &uvs)
-    : index_buf(indices),
-      normal_buf(normals),
-      uv_buf(uvs),
-      geom(rtcNewGeometry(device, RTC_GEOMETRY_TYPE_TRIANGLE))
-{
-    vertex_buf.reserve(verts.size());
-    std::transform(
-        verts.begin(), verts.end(), std::back_inserter(vertex_buf), [](const glm::vec3 &v) {
-            return glm::vec4(v, 0.f);
-        });
-
-    vbuf =
-        rtcNewSharedBuffer(device, vertex_buf.data(), vertex_buf.size() * sizeof(glm::vec4));
-    ibuf = rtcNewSharedBuffer(device, index_buf.data(), index_buf.size() * sizeof(glm::uvec3));
+                   const AttributeBuffer<glm::vec3> &verts,
+                   const AttributeBuffer<glm::uvec3> &indices,
+                   const AttributeBuffer<glm::vec3> &normals,
+                   const AttributeBuffer<glm::vec2> &uvs,
+                   const glm::uvec2 &grid_dims,
+                   const bool share_external)
+    : geom(rtcNewGeometry(device,
+                          grid_dims.x != 0 && grid_dims.y != 0 ? RTC_GEOMETRY_TYPE_GRID
+                                                               : RTC_GEOMETRY_TYPE_TRIANGLE))
+{
+#ifdef EMBREE_COMPACT_ATTRIBUTES
+    // The kernels shade with the geometric normal, so the normals are dropped
+    static_cast<void>(normals);
+    uv_buf.reserve(uvs.size());
+    std::transform(uvs.begin(),
+                   uvs.end(),
+                   std::back_inserter(uv_buf),
+                   [](const glm::vec2 &uv) { return glm::packHalf2x16(uv); });
+    if (!uv_buf.empty()) {
+        uv_data = uv_buf.data();
+    }
+#else
+    normal_data = share_or_copy(normals, share_external, normal_buf, shared_owners);
+    uv_data = share_or_copy(uvs, share_external, uv_buf, shared_owners);
+#endif
+
+    // External vertex buffers are padded enough for Embree's vector loads of the last
+    // vertex, so they can be shared with their 12 byte stride. Otherwise the vertices are
+    // copied and padded out to 16 bytes each
+    size_t vertex_stride = sizeof(glm::vec3);
+    if (share_external && verts.is_external()) {
+        shared_owners.push_back(verts.owner());
+        vbuf = rtcNewSharedBuffer(device,
+                                  const_cast<glm::vec3 *>(verts.data()),
+                                  verts.size() * sizeof(glm::vec3));
+    } else {
+        vertex_buf.reserve(verts.size());
+        std::transform(verts.begin(),
+                       verts.end(),
+                       std::back_inserter(vertex_buf),
+                       [](const glm::vec3 &v) { return glm::vec4(v, 0.f); });
+        vertex_stride = sizeof(glm::vec4);
+        vbuf = rtcNewSharedBuffer(
+            device, vertex_buf.data(), vertex_buf.size() * sizeof(glm::vec4));
+    }
 
     rtcSetGeometryBuffer(geom,
                          RTC_BUFFER_TYPE_VERTEX,
@@ -32,19 +79,50 @@ Geometry::Geometry(RTCDevice &device,
                          RTC_FORMAT_FLOAT3,
                          vbuf,
                          0,
-                         sizeof(glm::vec4),
-                         vertex_buf.size());
-    rtcSetGeometryBuffer(geom,
-                         RTC_BUFFER_TYPE_INDEX,
-                         0,
-                         RTC_FORMAT_UINT3,
-                         ibuf,
-                         0,
-                         sizeof(glm::uvec3),
-                         index_buf.size());
-
+                         vertex_stride,
+                         verts.size());
     rtcUpdateGeometryBuffer(geom, RTC_BUFFER_TYPE_VERTEX, 0);
-    rtcUpdateGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0);
+
+    if (grid_dims.x != 0 && grid_dims.y != 0) {
+        // Embree limits the size of a single grid, so we split it into sub-grids which
+        // share their border vertices. The sub-grid index is the primitive ID of a hit
+        const uint32_t max_grid_cells = 256;
+        for (uint32_t y = 0; y + 1 < grid_dims.y; y += max_grid_cells) {
+            for (uint32_t x = 0; x + 1 < grid_dims.x; x += max_grid_cells) {
+                RTCGrid g;
+                g.startVertexID = y * grid_dims.x + x;
+                g.stride = grid_dims.x;
+                g.width = std::min(max_grid_cells, grid_dims.x - 1 - x) + 1;
+                g.height = std::min(max_grid_cells, grid_dims.y - 1 - y) + 1;
+                grid_buf.push_back(g);
+            }
+        }
+
+        gbuf = rtcNewSharedBuffer(device, grid_buf.data(), grid_buf.size() * sizeof(RTCGrid));
+        rtcSetGeometryBuffer(geom,
+                             RTC_BUFFER_TYPE_GRID,
+                             0,
+                             RTC_FORMAT_GRID,
+                             gbuf,
+                             0,
+                             sizeof(RTCGrid),
+                             grid_buf.size());
+        rtcUpdateGeometryBuffer(geom, RTC_BUFFER_TYPE_GRID, 0);
+    } else {
+        index_data = share_or_copy(indices, share_external, index_buf, shared_owners);
+        ibuf = rtcNewSharedBuffer(device,
+                                  const_cast<glm::uvec3 *>(index_data),
+                                  indices.size() * sizeof(glm::uvec3));
+        rtcSetGeometryBuffer(geom,
+                             RTC_BUFFER_TYPE_INDEX,
+                             0,
+                             RTC_FORMAT_UINT3,
+                             ibuf,
+                             0,
+                             sizeof(glm::uvec3),
+                             indices.size());
+        rtcUpdateGeometryBuffer(geom, RTC_BUFFER_TYPE_INDEX, 0);
+    }
     rtcCommitGeometry(geom);
 }
 
@@ -53,19 +131,24 @@ Geometry::~Geometry()
     if (geom) {
         rtcReleaseGeometry(geom);
         rtcReleaseBuffer(vbuf);
-        rtcReleaseBuffer(ibuf);
+        if (ibuf) {
+            rtcReleaseBuffer(ibuf);
+        }
+        if (gbuf) {
+            rtcReleaseBuffer(gbuf);
+        }
     }
 }
 
 ISPCGeometry::ISPCGeometry(const Geometry &geom)
-    : vertex_buf(geom.vertex_buf.data()), index_buf(geom.index_buf.data())
+    : index_buf(geom.index_data), normal_buf(geom.normal_data), uv_buf(geom.uv_data)
 {
-    if (!geom.normal_buf.empty()) {
-        normal_buf = geom.normal_buf.data();
+    if (!geom.vertex_buf.empty()) {
+        vertex_buf = geom.vertex_buf.data();
     }
 
-    if (!geom.uv_buf.empty()) {
-        uv_buf = geom.uv_buf.data();
+    if (!geom.grid_buf.empty()) {
+        grid_buf = geom.grid_buf.data();
     }
 }
 
@@ -96,43 +179,61 @@ RTCScene TriangleMesh::handle()
     return scene;
 }
 
-Instance::Instance(RTCDevice &device,
-                   std::shared_ptr<TriangleMesh> &mesh,
-                   const glm::mat4 &xfm,
-                   const std::vector<uint32_t> &material_ids)
-    : handle(rtcNewGeometry(device, RTC_GEOMETRY_TYPE_INSTANCE)),
-      mesh(mesh),
-      object_to_world(xfm),
-      world_to_object(glm::inverse(object_to_world)),
-      material_ids(material_ids)
+ShadingRecord::ShadingRecord(const ISPCGeometry &geometry, const uint32_t material_id)
+    : geometry(geometry), material_id(material_id)
 {
-    rtcSetGeometryInstancedScene(handle, mesh->handle());
-    rtcSetGeometryTransform(
-        handle, 0, RTC_FORMAT_FLOAT4X4_COLUMN_MAJOR, glm::value_ptr(object_to_world));
-    rtcCommitGeometry(handle);
 }
 
-Instance::~Instance()
+void InstanceTable::add_mesh_instance(const glm::mat4 &transform, const uint32_t record_offset)
 {
-    if (handle) {
-        rtcReleaseGeometry(handle);
+    if (num_mesh_instances != ids.size()) {
+        throw std::runtime_error("Mesh instances must be added before group instances");
     }
+    add_instance(transform, record_offset);
+    ++num_mesh_instances;
+}
+
+void InstanceTable::add_group_instance(const glm::mat4 &transform, const uint32_t group_id)
+{
+    add_instance(transform, group_id);
+}
+
+void InstanceTable::add_instance(const glm::mat4 &transform, const uint32_t id)
+{
+    object_to_world.push_back(glm::mat4x3(transform));
+    normal_matrix.push_back(glm::transpose(glm::inverse(glm::mat3(transform))));
+    ids.push_back(id);
+}
+
+size_t InstanceTable::size() const
+{
+    return ids.size();
 }
 
-ISPCInstance::ISPCInstance(const Instance &instance)
-    : geometries(instance.mesh->ispc_geometries.data()),
-      object_to_world(glm::value_ptr(instance.object_to_world)),
-      world_to_object(glm::value_ptr(instance.world_to_object)),
-      material_ids(instance.material_ids.data())
+ISPCInstanceTable::ISPCInstanceTable(const InstanceTable &table)
+    : normal_matrix(table.normal_matrix.data()),
+      ids(table.ids.data()),
+      num_mesh_instances(table.num_mesh_instances)
 {
 }
 
-TopLevelBVH::TopLevelBVH(RTCDevice &device, const std::vector<std::shared_ptr<Instance>> &inst)
-    : handle(rtcNewScene(device)), instances(inst)
+TopLevelBVH::TopLevelBVH(RTCDevice &device,
+                         InstanceTable inst,
+                         const std::vector<RTCScene> &instanced_scenes)
+    : handle(rtcNewScene(device)), instances(std::move(inst))
 {
-    for (const auto &i : instances) {
-        rtcAttachGeometry(handle, i->handle);
-        ispc_instances.push_back(*i);
+    // The scene holds its own reference to the instance geometries, so we don't need to
+    // keep an RTCGeometry around for each instance
+    for (size_t i = 0; i < instances.size(); ++i) {
+        RTCGeometry geom = rtcNewGeometry(device, RTC_GEOMETRY_TYPE_INSTANCE);
+        rtcSetGeometryInstancedScene(geom, instanced_scenes[i]);
+        rtcSetGeometryTransform(geom,
+                                0,
+                                RTC_FORMAT_FLOAT3X4_COLUMN_MAJOR,
+                                glm::value_ptr(instances.object_to_world[i]));
+        rtcCommitGeometry(geom);
+        rtcAttachGeometryByID(handle, geom, i);
+        rtcReleaseGeometry(geom);
     }
     rtcCommitScene(handle);
 }
@@ -6,28 +6,52 @@
 #include <embree3/rtcore.h>
 #include "lights.h"
 #include "material.h"
+#include "mesh.h"
 #include <glm/glm.hpp>
 
 namespace embree {
 
 struct Geometry {
+    // Copies of the scene's attributes. Attributes which reference external buffers are
+    // instead shared in place, unless a copy is needed for NUMA replication, and the buffers'
+    // owners are kept alive in shared_owners
     std::vector<glm::vec4> vertex_buf;
     std::vector<glm::uvec3> index_buf;
     std::vector<glm::vec3> normal_buf;
+#ifdef EMBREE_COMPACT_ATTRIBUTES
+    // The uvs packed as two halfs, the normals are left empty in compact mode
+    std::vector<uint32_t> uv_buf;
+#else
     std::vector<glm::vec2> uv_buf;
+#endif
+    // Grid geometries are made of sub-grids over the row-major vertices and have no indices
+    std::vector<RTCGrid> grid_buf;
+    std::vector<std::shared_ptr<const void>> shared_owners;
+
+    // The attributes read by the kernels, pointing to the copies or the shared buffers
+    const glm::uvec3 *index_data = nullptr;
+    const glm::vec3 *normal_data = nullptr;
+#ifdef EMBREE_COMPACT_ATTRIBUTES
+    const uint32_t *uv_data = nullptr;
+#else
+    const glm::vec2 *uv_data = nullptr;
+#endif
 
     RTCBuffer vbuf = 0;
     RTCBuffer ibuf = 0;
+    RTCBuffer gbuf = 0;
 
     RTCGeometry geom = 0;
 
     Geometry() = default;
 
     Geometry(RTCDevice &device,
-             const std::vector<glm::vec3> &verts,
-             const std::vector<glm::uvec3> &indices,
-             const std::vector<glm::vec3> &normals,
-             const std::vector<glm::vec2> &uvs);
+             const AttributeBuffer<glm::vec3> &verts,
+             const AttributeBuffer<glm::uvec3> &indices,
+             const AttributeBuffer<glm::vec3> &normals,
+             const AttributeBuffer<glm::vec2> &uvs,
+             const glm::uvec2 &grid_dims,
+             const bool share_external);
 
     ~Geometry();
 
@@ -36,10 +60,16 @@ struct Geometry {
 };
 
 struct ISPCGeometry {
+    // Null if the vertices are shared in place, the kernels only access them through Embree
     const glm::vec4 *vertex_buf = nullptr;
     const glm::uvec3 *index_buf = nullptr;
     const glm::vec3 *normal_buf = nullptr;
+#ifdef EMBREE_COMPACT_ATTRIBUTES
+    const uint32_t *uv_buf = nullptr;
+#else
     const glm::vec2 *uv_buf = nullptr;
+#endif
+    const RTCGrid *grid_buf = nullptr;
 
     ISPCGeometry() = default;
     ISPCGeometry(const Geometry &geom);
@@ -64,42 +94,62 @@ public:
     RTCScene handle();
 };
 
-struct Instance {
-    RTCGeometry handle = 0;
-    std::shared_ptr<TriangleMesh> mesh = nullptr;
-    glm::mat4 object_to_world, world_to_object;
-    std::vector<uint32_t> material_ids;
+/* The data needed to shade a hit on a geometry of a parameterized mesh. The records for
+ * each parameterized mesh's geometries are stored contiguously in a flat array, so a hit
+ * finds its record at the instance's record offset plus its geometry ID.
+ */
+struct ShadingRecord {
+    ISPCGeometry geometry;
+    uint32_t material_id = -1;
 
-    Instance() = default;
+    ShadingRecord() = default;
+    ShadingRecord(const ISPCGeometry &geometry, const uint32_t material_id);
+};
+
+/* Compact storage for the instances in a BVH, stored as a structure of arrays. The
+ * instances of parameterized meshes come first, followed by the instances of instance
+ * groups, so the id of an instance is its shading record offset if it's before
+ * num_mesh_instances and its group id otherwise.
+ */
+struct InstanceTable {
+    // 3x4 column-major affine object to world transforms
+    std::vector<glm::mat4x3> object_to_world;
+    // The inverse transpose of the linear part of the transforms, to transform normals
+    // back to world space
+    std::vector<glm::mat3> normal_matrix;
+    std::vector<uint32_t> ids;
+    uint32_t num_mesh_instances = 0;
+
+    void add_mesh_instance(const glm::mat4 &transform, const uint32_t record_offset);
 
-    Instance(RTCDevice &device,
-             std::shared_ptr<TriangleMesh> &mesh,
-             const glm::mat4 &object_to_world,
-             const std::vector<uint32_t> &material_ids);
+    void add_group_instance(const glm::mat4 &transform, const uint32_t group_id);
 
-    ~Instance();
+    size_t size() const;
 
-    Instance(const Instance &) = delete;
-    Instance &operator=(const Instance &) = delete;
+private:
+    void add_instance(const glm::mat4 &transform, const uint32_t id);
 };
 
-struct ISPCInstance {
-    const ISPCGeometry *geometries = nullptr;
-    const float *object_to_world = nullptr;
-    const float *world_to_object = nullptr;
-    const uint32_t *material_ids = nullptr;
+struct ISPCInstanceTable {
+    const glm::mat3 *normal_matrix = nullptr;
+    const uint32_t *ids = nullptr;
+    uint32_t num_mesh_instances = 0;
 
-    ISPCInstance() = default;
-    ISPCInstance(const Instance &instance);
+    ISPCInstanceTable() = default;
+    ISPCInstanceTable(const InstanceTable &table);
 };
 
 struct TopLevelBVH {
     RTCScene handle = 0;
-    std::vector<std::shared_ptr<Instance>> instances;
-    std::vector<ISPCInstance> ispc_instances;
+    InstanceTable instances;
 
     TopLevelBVH() = default;
-    TopLevelBVH(RTCDevice &device, const std::vector<std::shared_ptr<Instance>> &instances);
+
+    // The instanced scenes are the BVH instanced by each instance in the table
+    TopLevelBVH(RTCDevice &device,
+                InstanceTable instances,
+                const std::vector<RTCScene> &instanced_scenes);
+
     ~TopLevelBVH();
 
     TopLevelBVH(const TopLevelBVH &) = delete;
@@ -134,14 +184,51 @@ struct MaterialParams {
     float specular_transmission = 0;
 };
 
+// Matches HistoryMode in render_embree.ispc
+enum HistoryMode { HISTORY_OFF, HISTORY_RESET, HISTORY_SAME_VIEW, HISTORY_REPROJECT };
+
+struct FrameBuffers {
+    float *color = nullptr;
+    uint32_t *sample_count = nullptr;
+    float *depth = nullptr;
+    float *normal = nullptr;
+};
+
+// Matches HitCacheMode in render_embree.ispc
+enum HitCacheMode { HIT_CACHE_OFF, HIT_CACHE_WRITE, HIT_CACHE_READ };
+
+// Matches CachedHit in render_embree.ispc
+struct CachedHit {
+    float tfar;
+    float u, v;
+    float Ng_x, Ng_y, Ng_z;
+    uint32_t geomID;
+    uint32_t primID;
+    uint32_t instID[RTC_MAX_INSTANCE_LEVEL_COUNT];
+};
+
 struct ViewParams {
     glm::vec3 pos, dir_du, dir_dv, dir_top_left;
     uint32_t frame_id;
+    uint32_t integrator;
+    uint32_t ao_samples;
+    float ao_distance;
+
+    uint32_t history_mode = HISTORY_OFF;
+    glm::vec3 prev_pos, prev_dir_du, prev_dir_dv, prev_dir_top_left;
+    FrameBuffers current;
+    FrameBuffers previous;
+
+    uint32_t hit_cache_mode = HIT_CACHE_OFF;
+    uint32_t hit_cache_pattern = 0;
+    CachedHit *hit_cache = nullptr;
 };
 
 struct SceneContext {
     RTCScene scene;
-    ISPCInstance *instances;
+    ISPCInstanceTable instances;
+    ISPCInstanceTable *groups;
+    ShadingRecord *shading_records;
     MaterialParams *materials;
     QuadLight *lights;
     ISPCTexture2D *textures;
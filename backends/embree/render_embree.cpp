@@ -1,21 +1,172 @@
 #include "render_embree.h"
 #include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <limits>
 #include <numeric>
+#include <thread>
+#include <tbb/blocked_range.h>
 #include <tbb/global_control.h>
 #include <tbb/parallel_for.h>
+#include <tbb/task_group.h>
 #ifndef __aarch64__
 #include <pmmintrin.h>
 #include <xmmintrin.h>
 #endif
 #include <util.h>
+#include "json.hpp"
 #include "render_embree_ispc.h"
 #include <glm/ext.hpp>
 
 static std::unique_ptr<tbb::global_control> tbb_thread_config;
 
+// Tile schedules found by autotuning are saved to this file, keyed by the machine and scene
+static const std::string tile_schedule_file = "embree_tile_schedules.json";
+
+static const std::array<std::string, 4> partitioner_names = {
+    "auto", "simple", "static", "affinity"};
+
+static nlohmann::json load_tile_schedules()
+{
+    nlohmann::json schedules = nlohmann::json::object();
+    std::ifstream fin(tile_schedule_file);
+    if (fin) {
+        try {
+            fin >> schedules;
+        } catch (const std::exception &e) {
+            std::cout << "Failed to read tile schedules from " << tile_schedule_file << ": "
+                      << e.what() << "\n";
+            schedules = nlohmann::json::object();
+        }
+    }
+    return schedules;
+}
+
+/* Read a saved tile schedule, returning false and leaving the schedule unchanged if the
+ * entry isn't valid, e.g. after the file was edited by hand
+ */
+static bool read_tile_schedule(const nlohmann::json &entry,
+                               uint32_t &tile_size,
+                               TilePartitioner &partitioner,
+                               uint32_t &grain_size)
+{
+    try {
+        const std::string name = entry.at("partitioner").get<std::string>();
+        const auto p = std::find(partitioner_names.begin(), partitioner_names.end(), name);
+        const uint32_t size = entry.at("tile_size").get<uint32_t>();
+        const uint32_t grain = entry.at("grain_size").get<uint32_t>();
+        if (p == partitioner_names.end()) {
+            throw std::runtime_error("unknown partitioner " + name);
+        }
+        if (size == 0 || grain == 0) {
+            throw std::runtime_error("invalid tile or grain size");
+        }
+        tile_size = size;
+        partitioner =
+            static_cast<TilePartitioner>(std::distance(partitioner_names.begin(), p));
+        grain_size = grain;
+        return true;
+    } catch (const std::exception &e) {
+        std::cout << "Ignoring invalid saved tile schedule: " << e.what() << "\n";
+    }
+    return false;
+}
+
+// Pins each TBB worker thread to the next core after the reserved cores when it joins the
+// scheduler. The main thread is left unpinned, so it's free to run on the reserved cores
+class ThreadPinningObserver : public tbb::task_scheduler_observer {
+    std::atomic<uint32_t> next_core;
+    const uint32_t first_core;
+    const uint32_t num_cores;
+
+public:
+    ThreadPinningObserver(const uint32_t first_core, const uint32_t num_cores)
+        : next_core(0), first_core(first_core), num_cores(num_cores)
+    {
+        observe(true);
+    }
+
+    ~ThreadPinningObserver()
+    {
+        observe(false);
+    }
+
+    void on_scheduler_entry(bool is_worker) override
+    {
+        static thread_local bool pinned = false;
+        if (is_worker && !pinned) {
+            set_thread_affinity({first_core + next_core++ % num_cores});
+            pinned = true;
+        }
+    }
+};
+
+// Restricts the threads to the NUMA node's cores while they're working in the node's arena
+class NodePinningObserver : public tbb::task_scheduler_observer {
+    const std::vector<uint32_t> node_cores;
+    const std::vector<uint32_t> all_cores;
+
+public:
+    NodePinningObserver(tbb::task_arena &arena,
+                        const std::vector<uint32_t> &node_cores,
+                        const std::vector<uint32_t> &all_cores)
+        : tbb::task_scheduler_observer(arena), node_cores(node_cores), all_cores(all_cores)
+    {
+        observe(true);
+    }
+
+    ~NodePinningObserver()
+    {
+        observe(false);
+    }
+
+    void on_scheduler_entry(bool) override
+    {
+        set_thread_affinity(node_cores);
+    }
+
+    void on_scheduler_exit(bool) override
+    {
+        set_thread_affinity(all_cores);
+    }
+};
+
+void FrameHistory::resize(const size_t num_pixels)
+{
+    color.resize(num_pixels * 3, 0.f);
+    sample_count.resize(num_pixels, 0);
+    depth.resize(num_pixels, -1.f);
+    normal.resize(num_pixels * 3, 0.f);
+}
+
+embree::FrameBuffers FrameHistory::ispc_buffers()
+{
+    embree::FrameBuffers buffers;
+    buffers.color = color.data();
+    buffers.sample_count = sample_count.data();
+    buffers.depth = depth.data();
+    buffers.normal = normal.data();
+    return buffers;
+}
+
+embree::SceneContext SceneReplica::ispc_context()
+{
+    embree::SceneContext ctx;
+    ctx.scene = scene_bvh->handle;
+    ctx.instances = embree::ISPCInstanceTable(scene_bvh->instances);
+    ctx.groups = ispc_groups.data();
+    ctx.shading_records = shading_records.data();
+    ctx.materials = material_params.data();
+    ctx.textures = ispc_textures.data();
+    ctx.lights = lights.data();
+    ctx.num_lights = lights.size();
+    return ctx;
+}
+
 RenderEmbree::RenderEmbree()
 {
 #ifndef __aarch64__
@@ -30,14 +181,110 @@ RenderEmbree::~RenderEmbree()
     rtcReleaseDevice(device);
 }
 
+// The ISPC kernels are compiled for multiple targets and dispatch to the best one supported
+// by the CPU, with Embree's ray packet width matching the target's width
+static std::string ispc_target_name()
+{
+    const std::array<std::string, 5> isa_names = {"generic", "SSE4", "AVX2", "AVX-512", "NEON"};
+    const int isa = ispc::target_isa();
+    return isa_names[isa] + " x" + std::to_string(ispc::target_width());
+}
+
 std::string RenderEmbree::name()
 {
-    return "Embree (w/ TBB & ISPC)";
+    return "Embree (w/ TBB & ISPC " + ispc_target_name() + ")";
+}
+
+void RenderEmbree::set_cpu_options(const CPUOptions &options)
+{
+    const uint32_t hw_threads = std::max(std::thread::hardware_concurrency(), 1u);
+    const uint32_t reserved = std::min(options.reserved_threads, hw_threads - 1);
+    const uint32_t num_threads =
+        options.num_threads != 0 ? options.num_threads : hw_threads - reserved;
+
+    tbb_thread_config = std::make_unique<tbb::global_control>(
+        tbb::global_control::max_allowed_parallelism, num_threads);
+
+    std::string config = "threads=" + std::to_string(num_threads);
+    if (options.huge_pages) {
+        config += ",hugepages=1";
+    }
+    rtcReleaseDevice(device);
+    device = rtcNewDevice(config.c_str());
+    if (!device) {
+        throw std::runtime_error("Failed to create Embree device with config " + config);
+    }
+
+    // In NUMA mode the threads are restricted to their node's cores instead
+    thread_pinning = nullptr;
+    if (options.pin_threads && !options.numa) {
+        thread_pinning =
+            std::make_unique<ThreadPinningObserver>(reserved, hw_threads - reserved);
+    }
+
+    autotune = options.autotune;
+    path_regeneration = options.path_regeneration;
+
+    numa_nodes.clear();
+    replicate_scene = options.numa_replicate;
+    uint32_t render_threads = num_threads;
+    if (options.numa) {
+        std::vector<uint32_t> all_cores(hw_threads);
+        std::iota(all_cores.begin(), all_cores.end(), 0);
+
+        const CPUTopology topology = get_cpu_topology();
+        std::vector<std::vector<uint32_t>> node_cores;
+        size_t total_cores = 0;
+        for (const auto &cores : topology.numa_nodes) {
+            std::vector<uint32_t> available;
+            std::copy_if(cores.begin(),
+                         cores.end(),
+                         std::back_inserter(available),
+                         [&](const uint32_t c) { return c >= reserved; });
+            if (!available.empty()) {
+                total_cores += available.size();
+                node_cores.push_back(std::move(available));
+            }
+        }
+
+        // Split the thread budget over the nodes in proportion to their cores. Nodes which
+        // get no threads from a small budget are left out
+        const size_t budget = std::min(size_t(num_threads), total_cores);
+        render_threads = budget;
+        size_t cores_before = 0;
+        for (auto &cores : node_cores) {
+            const size_t threads_begin = (budget * cores_before) / total_cores;
+            cores_before += cores.size();
+            const size_t threads = (budget * cores_before) / total_cores - threads_begin;
+            if (threads == 0) {
+                continue;
+            }
+            NUMANode node;
+            node.cores = std::move(cores);
+            node.arena = std::make_unique<tbb::task_arena>(threads, 0);
+            node.arena->initialize();
+            node.affinity = std::make_unique<tbb::affinity_partitioner>();
+            node.pinning =
+                std::make_unique<NodePinningObserver>(*node.arena, node.cores, all_cores);
+            std::cout << "NUMA node " << numa_nodes.size() << ": " << threads
+                      << " threads on " << node.cores.size() << " cores\n";
+            numa_nodes.push_back(std::move(node));
+        }
+    }
+
+    std::cout << "Embree rendering with " << render_threads << " threads"
+              << (numa_nodes.empty() ? "" : " over the NUMA nodes")
+              << (options.pin_threads ? ", pinned" : "")
+              << (options.huge_pages ? ", using huge pages" : "")
+              << (options.path_regeneration ? ", with path regeneration" : "")
+              << ", device config '"
+              << config << "'\n";
 }
 
 void RenderEmbree::initialize(const int fb_width, const int fb_height)
 {
     frame_id = 0;
+    history_valid = false;
     fb_dims = glm::ivec2(fb_width, fb_height);
     img.resize(fb_width * fb_height);
 
@@ -45,9 +292,30 @@ void RenderEmbree::initialize(const int fb_width, const int fb_height)
                             fb_dims.y / tile_size.y + (fb_dims.y % tile_size.y != 0 ? 1 : 0));
     tiles.resize(ntiles.x * ntiles.y);
     ray_stats.resize(tiles.size());
-    for (size_t i = 0; i < tiles.size(); ++i) {
-        tiles[i].resize(tile_size.x * tile_size.y * 3, 0.f);
-        ray_stats[i].resize(tile_size.x * tile_size.y, 0);
+    auto allocate_tiles = [&](const uint32_t begin, const uint32_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            tiles[i].resize(tile_size.x * tile_size.y * 3, 0.f);
+            ray_stats[i].resize(tile_size.x * tile_size.y, 0);
+        }
+    };
+
+    if (numa_nodes.empty()) {
+        allocate_tiles(0, tiles.size());
+    } else {
+        // Each node renders a contiguous band of tiles sized in proportion to its threads.
+        // The tiles are allocated in the node's arena so they're first touched by the node's
+        // memory
+        size_t total_threads = 0;
+        for (const auto &node : numa_nodes) {
+            total_threads += node.arena->max_concurrency();
+        }
+        size_t threads_before = 0;
+        for (auto &node : numa_nodes) {
+            node.tile_begin = (threads_before * tiles.size()) / total_threads;
+            threads_before += node.arena->max_concurrency();
+            node.tile_end = (threads_before * tiles.size()) / total_threads;
+            node.arena->execute([&] { allocate_tiles(node.tile_begin, node.tile_end); });
+        }
     }
 
 #ifdef REPORT_RAY_STATS
@@ -55,32 +323,179 @@ void RenderEmbree::initialize(const int fb_width, const int fb_height)
 #endif
 }
 
+size_t RenderEmbree::max_instance_levels()
+{
+    return RTC_MAX_INSTANCE_LEVEL_COUNT;
+}
+
+bool RenderEmbree::set_render_scale(const float scale)
+{
+    const float clamped_scale = glm::clamp(scale, MIN_RENDER_SCALE, 1.f);
+    if (clamped_scale == render_scale) {
+        return true;
+    }
+    render_scale = clamped_scale;
+    // The temporal history is kept and reprojected to the new resolution, and its frame id
+    // must keep alternating the history buffers
+    if (!temporal_reprojection) {
+        frame_id = 0;
+    }
+    return true;
+}
+
+bool RenderEmbree::set_temporal_reprojection(const bool enable)
+{
+    temporal_reprojection = enable;
+    if (!enable) {
+        history = std::array<FrameHistory, 2>();
+    }
+    frame_id = 0;
+    history_valid = false;
+    return true;
+}
+
+bool RenderEmbree::set_primary_hit_cache(const uint32_t num_patterns)
+{
+    hit_cache_patterns = num_patterns;
+    hit_cache = std::vector<embree::CachedHit>();
+    hit_cache_valid = std::vector<bool>(num_patterns, false);
+    frame_id = 0;
+    history_valid = false;
+    return true;
+}
+
+bool RenderEmbree::update_materials(const std::vector<DisneyMaterial> &materials)
+{
+    for (auto &r : replicas) {
+        r.set_materials(materials);
+    }
+    frame_id = 0;
+    history_valid = false;
+    return true;
+}
+
+bool RenderEmbree::update_lights(const std::vector<QuadLight> &lights)
+{
+    for (auto &r : replicas) {
+        r.lights = lights;
+    }
+    frame_id = 0;
+    history_valid = false;
+    return true;
+}
+
+bool RenderEmbree::set_integrator(const IntegratorParams &params)
+{
+    integrator = params;
+    integrator.ao_samples = std::max(integrator.ao_samples, 1u);
+    frame_id = 0;
+    history_valid = false;
+    return true;
+}
+
 void RenderEmbree::set_scene(const Scene &scene)
 {
     frame_id = 0;
+    history_valid = false;
+    std::fill(hit_cache_valid.begin(), hit_cache_valid.end(), false);
+    tile_schedule_pending = true;
+    scene_signature = std::to_string(scene.total_tris()) + " triangles, " +
+                      std::to_string(scene.instances.size()) + " instances, " +
+                      std::to_string(scene.textures.size()) + " textures";
+
+    parameterized_meshes = scene.parameterized_meshes;
 
-    std::vector<std::shared_ptr<embree::TriangleMesh>> meshes;
+    replicas.clear();
+    if (replicate_scene && !numa_nodes.empty()) {
+        // Build each node's replica in its arena, so the scene data is first touched and
+        // placed in the node's memory
+        replicas.resize(numa_nodes.size());
+        for (size_t i = 0; i < numa_nodes.size(); ++i) {
+            numa_nodes[i].arena->execute([&] { build_replica(scene, replicas[i]); });
+        }
+    } else {
+        replicas.resize(1);
+        build_replica(scene, replicas[0]);
+    }
+
+    RTCBounds bounds;
+    rtcGetSceneBounds(replicas[0].scene_bvh->handle, &bounds);
+    scene_diagonal = glm::length(glm::vec3(bounds.upper_x - bounds.lower_x,
+                                           bounds.upper_y - bounds.lower_y,
+                                           bounds.upper_z - bounds.lower_z));
+}
+
+void RenderEmbree::build_replica(const Scene &scene, SceneReplica &replica)
+{
+    // Geometry referencing external buffers (e.g., a mapped CRTS file) is shared in place,
+    // unless each NUMA node gets its own copy of the scene
+    const bool share_external = !replicate_scene || numa_nodes.empty();
+    auto &meshes = replica.meshes;
     for (const auto &mesh : scene.meshes) {
         std::vector<std::shared_ptr<embree::Geometry>> geometries;
         for (const auto &geom : mesh.geometries) {
-            geometries.push_back(std::make_shared<embree::Geometry>(
-                device, geom.vertices, geom.indices, geom.normals, geom.uvs));
+            geometries.push_back(std::make_shared<embree::Geometry>(device,
+                                                                    geom.vertices,
+                                                                    geom.indices,
+                                                                    geom.normals,
+                                                                    geom.uvs,
+                                                                    geom.grid_dims,
+                                                                    share_external));
         }
 
         meshes.push_back(std::make_shared<embree::TriangleMesh>(device, geometries));
     }
 
-    parameterized_meshes = scene.parameterized_meshes;
+    // Flatten the material and geometry lookup for each parameterized mesh's geometries
+    // into shading records, so the mesh instances can reference their records directly
+    std::vector<uint32_t> record_offsets;
+    auto &shading_records = replica.shading_records;
+    for (const auto &pm : parameterized_meshes) {
+        record_offsets.push_back(shading_records.size());
+        const auto &mesh = meshes[pm.mesh_id];
+        for (size_t i = 0; i < mesh->ispc_geometries.size(); ++i) {
+            shading_records.emplace_back(mesh->ispc_geometries[i], pm.material_ids[i]);
+        }
+    }
 
-    std::vector<std::shared_ptr<embree::Instance>> instances;
-    for (const auto &inst : scene.instances) {
-        const auto &pm = parameterized_meshes[inst.parameterized_mesh_id];
-        instances.push_back(std::make_shared<embree::Instance>(
-            device, meshes[pm.mesh_id], inst.transform, pm.material_ids));
+    // Build the instance group BVHs bottom up, so the groups instanced by a group are built
+    // before it
+    auto &groups = replica.groups;
+    groups.resize(scene.instance_groups.size());
+    std::function<RTCScene(size_t)> build_group;
+    auto build_bvh = [&](const std::vector<Instance> &insts,
+                         const std::vector<GroupInstance> &group_insts) {
+        embree::InstanceTable table;
+        std::vector<RTCScene> instanced_scenes;
+        for (const auto &inst : insts) {
+            const auto &pm = parameterized_meshes[inst.parameterized_mesh_id];
+            table.add_mesh_instance(inst.transform,
+                                    record_offsets[inst.parameterized_mesh_id]);
+            instanced_scenes.push_back(meshes[pm.mesh_id]->handle());
+        }
+        for (const auto &gi : group_insts) {
+            table.add_group_instance(gi.transform, gi.group_id);
+            instanced_scenes.push_back(build_group(gi.group_id));
+        }
+        return std::make_shared<embree::TopLevelBVH>(
+            device, std::move(table), instanced_scenes);
+    };
+    build_group = [&](size_t id) {
+        if (!groups[id]) {
+            const auto &group = scene.instance_groups[id];
+            groups[id] = build_bvh(group.instances, group.group_instances);
+        }
+        return groups[id]->handle;
+    };
+
+    for (size_t i = 0; i < groups.size(); ++i) {
+        build_group(i);
+        replica.ispc_groups.emplace_back(groups[i]->instances);
     }
 
-    scene_bvh = std::make_shared<embree::TopLevelBVH>(device, instances);
+    replica.scene_bvh = build_bvh(scene.instances, scene.group_instances);
 
+    auto &textures = replica.textures;
     textures = scene.textures;
 
     // Linearize any sRGB textures beforehand, since we don't have fancy sRGB texture
@@ -101,14 +516,21 @@ void RenderEmbree::set_scene(const Scene &scene)
         });
     });
 
-    ispc_textures.reserve(textures.size());
+    replica.ispc_textures.reserve(textures.size());
     std::transform(textures.begin(),
                    textures.end(),
-                   std::back_inserter(ispc_textures),
+                   std::back_inserter(replica.ispc_textures),
                    [](const Image &img) { return embree::ISPCTexture2D(img); });
 
-    material_params.reserve(scene.materials.size());
-    for (const auto &m : scene.materials) {
+    replica.set_materials(scene.materials);
+    replica.lights = scene.lights;
+}
+
+void SceneReplica::set_materials(const std::vector<DisneyMaterial> &materials)
+{
+    material_params.clear();
+    material_params.reserve(materials.size());
+    for (const auto &m : materials) {
         embree::MaterialParams p;
 
         p.base_color = m.base_color;
@@ -126,8 +548,6 @@ void RenderEmbree::set_scene(const Scene &scene)
 
         material_params.push_back(p);
     }
-
-    lights = scene.lights;
 }
 
 RenderStats RenderEmbree::render(const glm::vec3 &pos,
@@ -140,7 +560,28 @@ RenderStats RenderEmbree::render(const glm::vec3 &pos,
     using namespace std::chrono;
     RenderStats stats;
 
-    if (camera_changed) {
+    if (tile_schedule_pending) {
+        tile_schedule_pending = false;
+        if (autotune) {
+            autotune_tile_schedule(pos, dir, up, fovy);
+        } else {
+            const nlohmann::json schedules = load_tile_schedules();
+            auto fnd = schedules.find(tile_schedule_key());
+            uint32_t size = 0;
+            if (fnd != schedules.end() &&
+                read_tile_schedule(*fnd, size, partitioner, grain_size)) {
+                tile_size = glm::uvec2(size);
+                std::cout << "Using autotuned tile size " << tile_size.x << ", "
+                          << partitioner_names[static_cast<int>(partitioner)]
+                          << " partitioner and grain size " << grain_size << "\n";
+                initialize(fb_dims.x, fb_dims.y);
+            }
+        }
+    }
+
+    // With temporal reprojection the frame id only seeds the RNG, the sample counts are
+    // kept per pixel in the history buffers
+    if (camera_changed && !temporal_reprojection) {
         frame_id = 0;
     }
 
@@ -155,27 +596,78 @@ RenderStats RenderEmbree::render(const glm::vec3 &pos,
         -glm::normalize(glm::cross(view_params.dir_du, dir)) * img_plane_size.y;
     view_params.dir_top_left = dir - 0.5f * view_params.dir_du - 0.5f * view_params.dir_dv;
     view_params.frame_id = frame_id;
+    view_params.integrator = integrator.integrator;
+    view_params.ao_samples = integrator.ao_samples;
+    view_params.ao_distance = integrator.ao_radius * scene_diagonal;
+
+    std::vector<embree::SceneContext> ispc_scenes;
+    for (auto &r : replicas) {
+        ispc_scenes.push_back(r.ispc_context());
+    }
 
-    embree::SceneContext ispc_scene;
-    ispc_scene.scene = scene_bvh->handle;
-    ispc_scene.instances = scene_bvh->ispc_instances.data();
-    ispc_scene.materials = material_params.data();
-    ispc_scene.textures = ispc_textures.data();
-    ispc_scene.lights = lights.data();
-    ispc_scene.num_lights = lights.size();
+    // When rendering at a reduced resolution the tiles cover the smaller image, which is
+    // then upscaled to the framebuffer
+    const glm::uvec2 render_dims =
+        glm::max(glm::uvec2(glm::vec2(fb_dims) * render_scale), glm::uvec2(1));
+    const bool scaled = render_dims != fb_dims;
 
     // Round up the number of tiles we need to run in case the
     // framebuffer is not an even multiple of tile size
-    const glm::uvec2 ntiles(fb_dims.x / tile_size.x + (fb_dims.x % tile_size.x != 0 ? 1 : 0),
-                            fb_dims.y / tile_size.y + (fb_dims.y % tile_size.y != 0 ? 1 : 0));
+    const glm::uvec2 ntiles(
+        render_dims.x / tile_size.x + (render_dims.x % tile_size.x != 0 ? 1 : 0),
+        render_dims.y / tile_size.y + (render_dims.y % tile_size.y != 0 ? 1 : 0));
 
-    uint8_t *color = reinterpret_cast<uint8_t *>(img.data());
+    if (scaled) {
+        scaled_img.resize(render_dims.x * render_dims.y);
+    }
 
-    auto start = high_resolution_clock::now();
-    tbb::parallel_for(uint32_t(0), ntiles.x * ntiles.y, [&](uint32_t tile_id) {
+    // The cached primary hits are kept until the camera or resolution changes, each frame
+    // traces or reuses the hits of the next jitter pattern
+    if (hit_cache_patterns > 0) {
+        const size_t num_pixels = size_t(render_dims.x) * render_dims.y;
+        if (camera_changed || hit_cache_dims != render_dims) {
+            std::fill(hit_cache_valid.begin(), hit_cache_valid.end(), false);
+            hit_cache_dims = render_dims;
+        }
+        hit_cache.resize(hit_cache_patterns * num_pixels);
+
+        const uint32_t pattern = frame_id % hit_cache_patterns;
+        view_params.hit_cache_mode =
+            hit_cache_valid[pattern] ? embree::HIT_CACHE_READ : embree::HIT_CACHE_WRITE;
+        view_params.hit_cache_pattern = pattern;
+        view_params.hit_cache = hit_cache.data() + pattern * num_pixels;
+        hit_cache_valid[pattern] = true;
+    }
+
+    if (temporal_reprojection) {
+        // A change in the render resolution is reprojected like a camera motion, as the
+        // previous frame's pixels no longer line up with the new ones
+        if (!history_valid) {
+            view_params.history_mode = embree::HISTORY_RESET;
+        } else if (camera_changed || history_dims != render_dims) {
+            view_params.history_mode = embree::HISTORY_REPROJECT;
+        } else {
+            view_params.history_mode = embree::HISTORY_SAME_VIEW;
+        }
+        view_params.prev_fb_width = history_dims.x;
+        view_params.prev_fb_height = history_dims.y;
+        view_params.prev_pos = prev_view_params.pos;
+        view_params.prev_dir_du = prev_view_params.dir_du;
+        view_params.prev_dir_dv = prev_view_params.dir_dv;
+        view_params.prev_dir_top_left = prev_view_params.dir_top_left;
+
+        for (auto &h : history) {
+            h.resize(fb_dims.x * fb_dims.y);
+        }
+        view_params.current = history[frame_id % 2].ispc_buffers();
+        view_params.previous = history[(frame_id + 1) % 2].ispc_buffers();
+    }
+    uint8_t *color = reinterpret_cast<uint8_t *>(scaled ? scaled_img.data() : img.data());
+
+    auto render_tile = [&](embree::SceneContext &ispc_scene, const uint32_t tile_id) {
         const glm::uvec2 tile = glm::uvec2(tile_id % ntiles.x, tile_id / ntiles.x);
         const glm::uvec2 tile_pos = tile * tile_size;
-        const glm::uvec2 tile_end = glm::min(tile_pos + tile_size, fb_dims);
+        const glm::uvec2 tile_end = glm::min(tile_pos + tile_size, render_dims);
         const glm::uvec2 actual_tile_dims = tile_end - tile_pos;
 
         embree::Tile ispc_tile;
@@ -183,12 +675,16 @@ RenderStats RenderEmbree::render(const glm::vec3 &pos,
         ispc_tile.y = tile_pos.y;
         ispc_tile.width = actual_tile_dims.x;
         ispc_tile.height = actual_tile_dims.y;
-        ispc_tile.fb_width = fb_dims.x;
-        ispc_tile.fb_height = fb_dims.y;
+        ispc_tile.fb_width = render_dims.x;
+        ispc_tile.fb_height = render_dims.y;
         ispc_tile.data = tiles[tile_id].data();
         ispc_tile.ray_stats = ray_stats[tile_id].data();
 
-        ispc::trace_rays(&ispc_scene, &ispc_tile, &view_params);
+        if (path_regeneration) {
+            ispc::trace_rays_regenerate(&ispc_scene, &ispc_tile, &view_params);
+        } else {
+            ispc::trace_rays(&ispc_scene, &ispc_tile, &view_params);
+        }
 
         ispc::tile_to_uint8(&ispc_tile, color);
 #ifdef REPORT_RAY_STATS
@@ -198,16 +694,208 @@ RenderStats RenderEmbree::render(const glm::vec3 &pos,
             uint64_t(0),
             [](const uint64_t &total, const uint16_t &c) { return total + c; });
 #endif
-    });
+        return uint64_t(actual_tile_dims.x) * actual_tile_dims.y;
+    };
+
+    auto start = high_resolution_clock::now();
+    if (numa_nodes.empty()) {
+        parallel_for_tiles(0, ntiles.x * ntiles.y, affinity, [&](uint32_t tile_id) {
+            render_tile(ispc_scenes[0], tile_id);
+        });
+    } else {
+        // Each node renders its band of tiles in its own arena, using its replica of the
+        // scene if the scene is replicated. A reduced resolution frame has fewer tiles,
+        // which are split over the nodes in the same proportions
+        const uint32_t num_tiles = ntiles.x * ntiles.y;
+        std::vector<tbb::task_group> node_tasks(numa_nodes.size());
+        for (size_t i = 0; i < numa_nodes.size(); ++i) {
+            numa_nodes[i].arena->execute([&, i] {
+                node_tasks[i].run([&, i] {
+                    auto &node = numa_nodes[i];
+                    auto &ispc_scene = ispc_scenes[replicas.size() > 1 ? i : 0];
+                    std::atomic<uint64_t> samples(0);
+
+                    const uint32_t begin =
+                        (uint64_t(node.tile_begin) * num_tiles) / tiles.size();
+                    const uint32_t end = (uint64_t(node.tile_end) * num_tiles) / tiles.size();
+                    auto node_start = high_resolution_clock::now();
+                    parallel_for_tiles(begin, end, *node.affinity, [&](uint32_t tile_id) {
+                        samples += render_tile(ispc_scene, tile_id);
+                    });
+                    auto node_end = high_resolution_clock::now();
+
+                    node.render_time +=
+                        duration_cast<nanoseconds>(node_end - node_start).count() * 1.0e-9;
+                    node.samples += samples;
+#ifdef REPORT_RAY_STATS
+                    node.rays += std::accumulate(
+                        num_rays.begin() + begin, num_rays.begin() + end, uint64_t(0));
+#endif
+                });
+            });
+        }
+        for (size_t i = 0; i < numa_nodes.size(); ++i) {
+            numa_nodes[i].arena->execute([&, i] { node_tasks[i].wait(); });
+        }
+        report_numa_stats();
+    }
+    if (scaled) {
+        tbb::parallel_for(tbb::blocked_range<uint32_t>(0, fb_dims.y, 16),
+                          [&](const tbb::blocked_range<uint32_t> &r) {
+                              ispc::upscale_uint8(color,
+                                                  render_dims.x,
+                                                  render_dims.y,
+                                                  reinterpret_cast<uint8_t *>(img.data()),
+                                                  fb_dims.x,
+                                                  fb_dims.y,
+                                                  r.begin(),
+                                                  r.end());
+                          });
+    }
     auto end = high_resolution_clock::now();
     stats.render_time = duration_cast<nanoseconds>(end - start).count() * 1.0e-6;
 
 #ifdef REPORT_RAY_STATS
-    const uint64_t total_rays = std::accumulate(num_rays.begin(), num_rays.end(), 0);
+    const uint64_t total_rays =
+        std::accumulate(num_rays.begin(), num_rays.begin() + ntiles.x * ntiles.y, uint64_t(0));
     stats.rays_per_second = total_rays / (stats.render_time * 1.0e-3);
 #endif
 
+    if (temporal_reprojection) {
+        history_valid = true;
+        history_dims = render_dims;
+        prev_view_params = view_params;
+    }
+
     ++frame_id;
 
     return stats;
 }
+
+void RenderEmbree::report_numa_stats()
+{
+    // Report each node's throughput every few seconds of rendering
+    const double report_interval = 5.0;
+    if (numa_nodes[0].render_time < report_interval) {
+        return;
+    }
+    for (size_t i = 0; i < numa_nodes.size(); ++i) {
+        auto &node = numa_nodes[i];
+        std::cout << "NUMA node " << i << ": "
+                  << pretty_print_count(node.samples / node.render_time) << "samples/s";
+#ifdef REPORT_RAY_STATS
+        std::cout << ", " << pretty_print_count(node.rays / node.render_time) << "Ray/s";
+#endif
+        std::cout << "\n";
+        node.render_time = 0;
+        node.samples = 0;
+        node.rays = 0;
+    }
+}
+
+template <typename F>
+void RenderEmbree::parallel_for_tiles(const uint32_t begin,
+                                      const uint32_t end,
+                                      tbb::affinity_partitioner &affinity,
+                                      const F &render_tile)
+{
+    const tbb::blocked_range<uint32_t> range(begin, end, grain_size);
+    auto render_range = [&](const tbb::blocked_range<uint32_t> &r) {
+        for (uint32_t i = r.begin(); i != r.end(); ++i) {
+            render_tile(i);
+        }
+    };
+    switch (partitioner) {
+    case TilePartitioner::SIMPLE:
+        tbb::parallel_for(range, render_range, tbb::simple_partitioner());
+        break;
+    case TilePartitioner::STATIC:
+        tbb::parallel_for(range, render_range, tbb::static_partitioner());
+        break;
+    case TilePartitioner::AFFINITY:
+        tbb::parallel_for(range, render_range, affinity);
+        break;
+    default:
+        tbb::parallel_for(range, render_range, tbb::auto_partitioner());
+        break;
+    }
+}
+
+void RenderEmbree::autotune_tile_schedule(const glm::vec3 &pos,
+                                          const glm::vec3 &dir,
+                                          const glm::vec3 &up,
+                                          const float fovy)
+{
+    struct TileSchedule {
+        uint32_t tile_size;
+        TilePartitioner partitioner;
+        uint32_t grain_size;
+    };
+    // The ISPC target isn't part of the sweep: ISPC's auto-dispatch always runs the widest
+    // target the CPU supports and can't be overridden at runtime. The dispatched target is
+    // part of the schedule key instead, so builds with different targets tune separately
+    const std::array<uint32_t, 4> tile_sizes = {16, 32, 64, 128};
+    const std::array<std::pair<TilePartitioner, uint32_t>, 6> schedulers = {
+        std::make_pair(TilePartitioner::AUTO, 1),
+        std::make_pair(TilePartitioner::SIMPLE, 1),
+        std::make_pair(TilePartitioner::SIMPLE, 4),
+        std::make_pair(TilePartitioner::STATIC, 1),
+        std::make_pair(TilePartitioner::AFFINITY, 1),
+        std::make_pair(TilePartitioner::AFFINITY, 4)};
+
+    // Time a few frames with each schedule after a warm up frame, restarting accumulation
+    // each frame so they all do the same work
+    const size_t calibration_frames = 4;
+    std::cout << "Autotuning tile schedule for " << tile_schedule_key() << "\n";
+    TileSchedule best = {tile_size.x, partitioner, grain_size};
+    float best_time = std::numeric_limits<float>::infinity();
+    for (const auto &ts : tile_sizes) {
+        tile_size = glm::uvec2(ts);
+        initialize(fb_dims.x, fb_dims.y);
+        for (const auto &s : schedulers) {
+            partitioner = s.first;
+            grain_size = s.second;
+
+            render(pos, dir, up, fovy, true, false);
+            float time = 0.f;
+            for (size_t i = 0; i < calibration_frames; ++i) {
+                time += render(pos, dir, up, fovy, true, false).render_time;
+            }
+            time /= calibration_frames;
+
+            std::cout << "Tile size " << ts << ", " << partitioner_names[int(s.first)]
+                      << " partitioner, grain size " << s.second << ": " << time << "ms\n";
+            if (time < best_time) {
+                best_time = time;
+                best = {ts, s.first, s.second};
+            }
+        }
+    }
+
+    tile_size = glm::uvec2(best.tile_size);
+    partitioner = best.partitioner;
+    grain_size = best.grain_size;
+    initialize(fb_dims.x, fb_dims.y);
+    std::cout << "Best tile schedule: tile size " << best.tile_size << ", "
+              << partitioner_names[int(best.partitioner)] << " partitioner, grain size "
+              << best.grain_size << " (" << best_time << "ms)\n";
+
+    nlohmann::json schedules = load_tile_schedules();
+    nlohmann::json &entry = schedules[tile_schedule_key()];
+    entry["tile_size"] = best.tile_size;
+    entry["partitioner"] = partitioner_names[int(best.partitioner)];
+    entry["grain_size"] = best.grain_size;
+    entry["render_time_ms"] = best_time;
+    std::ofstream fout(tile_schedule_file);
+    fout << schedules.dump(4);
+}
+
+std::string RenderEmbree::tile_schedule_key() const
+{
+    const uint32_t num_threads =
+        tbb::global_control::active_value(tbb::global_control::max_allowed_parallelism);
+    return get_cpu_brand() + ", ISPC " + ispc_target_name() + ", " +
+           std::to_string(num_threads) + " threads" +
+           (numa_nodes.empty() ? "" : ", NUMA") + ": " + scene_signature + " at " +
+           std::to_string(fb_dims.x) + "x" + std::to_string(fb_dims.y);
+}
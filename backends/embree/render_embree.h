@@ -1,28 +1,122 @@
 #pragma once
 
+#include <array>
 #include <memory>
 #include <utility>
 #include <vector>
 #include <embree3/rtcore.h>
+#include <tbb/partitioner.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_scheduler_observer.h>
 #include "embree_utils.h"
 #include "material.h"
 #include "render_backend.h"
 
+/* The scene data read while rendering. In NUMA mode the scene can be replicated on each
+ * node, so each node's threads traverse and shade using node-local memory
+ */
+struct SceneReplica {
+    std::vector<std::shared_ptr<embree::TriangleMesh>> meshes;
+    std::vector<embree::ShadingRecord> shading_records;
+    std::vector<std::shared_ptr<embree::TopLevelBVH>> groups;
+    std::vector<embree::ISPCInstanceTable> ispc_groups;
+    std::shared_ptr<embree::TopLevelBVH> scene_bvh;
+
+    std::vector<embree::MaterialParams> material_params;
+    std::vector<QuadLight> lights;
+    std::vector<Image> textures;
+    std::vector<embree::ISPCTexture2D> ispc_textures;
+
+    void set_materials(const std::vector<DisneyMaterial> &materials);
+
+    embree::SceneContext ispc_context();
+};
+
+/* The full frame accumulated color, sample count and primary hit depth and normal used to
+ * reproject the accumulated samples when the camera moves or the render scale changes
+ */
+struct FrameHistory {
+    std::vector<float> color;
+    std::vector<uint32_t> sample_count;
+    std::vector<float> depth;
+    std::vector<float> normal;
+
+    void resize(const size_t num_pixels);
+
+    embree::FrameBuffers ispc_buffers();
+};
+
+// The TBB partitioner used to distribute the tiles over the threads
+enum class TilePartitioner { AUTO, SIMPLE, STATIC, AFFINITY };
+
+/* A NUMA node's task arena, with its threads restricted to the node's cores, and the range
+ * of tiles it renders
+ */
+struct NUMANode {
+    std::vector<uint32_t> cores;
+    std::unique_ptr<tbb::task_arena> arena;
+    std::unique_ptr<tbb::task_scheduler_observer> pinning;
+    uint32_t tile_begin = 0;
+    uint32_t tile_end = 0;
+    std::unique_ptr<tbb::affinity_partitioner> affinity;
+
+    // The node's render time and the samples and rays it traced since the last report
+    double render_time = 0;
+    uint64_t samples = 0;
+    uint64_t rays = 0;
+};
+
 struct RenderEmbree : RenderBackend {
     RTCDevice device;
     glm::uvec2 fb_dims;
+    std::unique_ptr<tbb::task_scheduler_observer> thread_pinning;
 
     // TODO: should take scene as shared ptr and keep ref to it,
     std::vector<ParameterizedMesh> parameterized_meshes;
-    std::shared_ptr<embree::TopLevelBVH> scene_bvh;
+    std::vector<SceneReplica> replicas;
 
-    std::vector<embree::MaterialParams> material_params;
-    std::vector<QuadLight> lights;
-    std::vector<Image> textures;
-    std::vector<embree::ISPCTexture2D> ispc_textures;
+    std::vector<NUMANode> numa_nodes;
+    bool replicate_scene = false;
 
     uint32_t frame_id = 0;
     glm::uvec2 tile_size = glm::uvec2(64);
+    TilePartitioner partitioner = TilePartitioner::AUTO;
+    uint32_t grain_size = 1;
+    tbb::affinity_partitioner affinity;
+
+    // The tile scheduling is autotuned on the first frame if requested, otherwise the
+    // settings saved by an earlier autotuning run for the machine and scene are used
+    bool autotune = false;
+    bool tile_schedule_pending = true;
+    std::string scene_signature;
+
+    // Trace with the kernel which refills the SIMD lanes of finished paths with new pixels
+    bool path_regeneration = false;
+
+    // The fraction of the framebuffer resolution rendered at, the reduced resolution image
+    // is rendered to scaled_img and upscaled to the framebuffer
+    float render_scale = 1.f;
+    std::vector<uint32_t> scaled_img;
+
+    // With temporal reprojection the samples are accumulated in the full frame history
+    // buffers, swapped each frame, and carried forward when the camera moves
+    bool temporal_reprojection = false;
+    bool history_valid = false;
+    std::array<FrameHistory, 2> history;
+    glm::uvec2 history_dims = glm::uvec2(0);
+    embree::ViewParams prev_view_params;
+
+    // The primary hits cached for each fixed jitter pattern while the camera is static, so
+    // material and light edits don't need to retrace the primary rays
+    uint32_t hit_cache_patterns = 0;
+    std::vector<embree::CachedHit> hit_cache;
+    std::vector<bool> hit_cache_valid;
+    glm::uvec2 hit_cache_dims = glm::uvec2(0);
+
+    IntegratorParams integrator;
+    // The scene's bounding box diagonal, to scale the ambient occlusion radius
+    float scene_diagonal = 1.f;
+
     std::vector<std::vector<float>> tiles;
     std::vector<std::vector<uint16_t>> ray_stats;
 #ifdef REPORT_RAY_STATS
@@ -33,7 +127,15 @@ struct RenderEmbree : RenderBackend {
     ~RenderEmbree();
 
     std::string name() override;
+    void set_cpu_options(const CPUOptions &options) override;
     void initialize(const int fb_width, const int fb_height) override;
+    size_t max_instance_levels() override;
+    bool set_render_scale(const float scale) override;
+    bool set_integrator(const IntegratorParams &params) override;
+    bool set_temporal_reprojection(const bool enable) override;
+    bool set_primary_hit_cache(const uint32_t num_patterns) override;
+    bool update_materials(const std::vector<DisneyMaterial> &materials) override;
+    bool update_lights(const std::vector<QuadLight> &lights) override;
     void set_scene(const Scene &scene) override;
     RenderStats render(const glm::vec3 &pos,
                        const glm::vec3 &dir,
@@ -41,4 +143,22 @@ struct RenderEmbree : RenderBackend {
                        const float fovy,
                        const bool camera_changed,
                        const bool readback_framebuffer) override;
+
+private:
+    void build_replica(const Scene &scene, SceneReplica &replica);
+
+    void report_numa_stats();
+
+    template <typename F>
+    void parallel_for_tiles(const uint32_t begin,
+                            const uint32_t end,
+                            tbb::affinity_partitioner &affinity,
+                            const F &render_tile);
+
+    void autotune_tile_schedule(const glm::vec3 &pos,
+                                const glm::vec3 &dir,
+                                const glm::vec3 &up,
+                                const float fovy);
+
+    std::string tile_schedule_key() const;
 };
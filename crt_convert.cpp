@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "crts.h"
+#include "scene.h"
+#include "util.h"
+
+const std::string USAGE =
+    "Usage: crt_convert <scene.obj/gltf/glb/crts/pbrt> <out.crts> [options]\n"
+    "Converts a scene to a CRTS v2 file, which loads without parsing and with the textures\n"
+    "already decoded\n"
+    "Options:\n"
+    "\t-compression <method>  Compress the buffer views with none, lz4 or zstd, if\n"
+    "\t                       supported by the build. Defaults to none\n"
+    "\t-compression-level <n> Set the LZ4 acceleration or zstd compression level\n"
+    "\t-merge-instances <n>   Bake the transforms of meshes instanced at most n times\n"
+    "\t                       and merge them into a few large meshes\n"
+    "\t-optimize-meshes       Weld duplicate vertices and reorder the triangles and\n"
+    "\t                       vertices of the meshes for better memory locality\n"
+    "\t-verify                Load the written file and check it matches the scene\n"
+    "\n";
+
+template <typename T>
+static bool same_bytes(const T *a, const T *b, const size_t count)
+{
+    return count == 0 || std::memcmp(a, b, count * sizeof(T)) == 0;
+}
+
+template <typename A, typename B>
+static bool same_array(const A &a, const B &b)
+{
+    return a.size() == b.size() && same_bytes(a.data(), b.data(), a.size());
+}
+
+static bool same_instances(const std::vector<Instance> &a, const std::vector<Instance> &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].parameterized_mesh_id != b[i].parameterized_mesh_id ||
+            !same_bytes(&a[i].transform, &b[i].transform, 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool same_group_instances(const std::vector<GroupInstance> &a,
+                                 const std::vector<GroupInstance> &b)
+{
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].group_id != b[i].group_id ||
+            !same_bytes(&a[i].transform, &b[i].transform, 1)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Check the scenes match exactly, returning a description of the first difference found
+static std::string compare_scenes(const Scene &a, const Scene &b)
+{
+    if (a.meshes.size() != b.meshes.size()) {
+        return "mesh count";
+    }
+    for (size_t i = 0; i < a.meshes.size(); ++i) {
+        const auto &ga = a.meshes[i].geometries;
+        const auto &gb = b.meshes[i].geometries;
+        if (ga.size() != gb.size()) {
+            return "geometry count of mesh " + std::to_string(i);
+        }
+        for (size_t j = 0; j < ga.size(); ++j) {
+            if (!same_array(ga[j].vertices, gb[j].vertices) ||
+                !same_array(ga[j].indices, gb[j].indices) ||
+                !same_array(ga[j].normals, gb[j].normals) ||
+                !same_array(ga[j].uvs, gb[j].uvs) || ga[j].grid_dims != gb[j].grid_dims) {
+                return "geometry " + std::to_string(j) + " of mesh " + std::to_string(i);
+            }
+        }
+    }
+
+    if (a.parameterized_meshes.size() != b.parameterized_meshes.size()) {
+        return "parameterized mesh count";
+    }
+    for (size_t i = 0; i < a.parameterized_meshes.size(); ++i) {
+        const auto &pa = a.parameterized_meshes[i];
+        const auto &pb = b.parameterized_meshes[i];
+        if (pa.mesh_id != pb.mesh_id || pa.material_ids != pb.material_ids) {
+            return "parameterized mesh " + std::to_string(i);
+        }
+    }
+
+    if (!same_instances(a.instances, b.instances)) {
+        return "instances";
+    }
+    if (!same_group_instances(a.group_instances, b.group_instances)) {
+        return "group instances";
+    }
+    if (a.instance_groups.size() != b.instance_groups.size()) {
+        return "instance group count";
+    }
+    for (size_t i = 0; i < a.instance_groups.size(); ++i) {
+        const auto &ia = a.instance_groups[i];
+        const auto &ib = b.instance_groups[i];
+        if (!same_instances(ia.instances, ib.instances) ||
+            !same_group_instances(ia.group_instances, ib.group_instances)) {
+            return "instance group " + std::to_string(i);
+        }
+    }
+
+    if (!same_array(a.materials, b.materials)) {
+        return "materials";
+    }
+    if (a.textures.size() != b.textures.size()) {
+        return "texture count";
+    }
+    for (size_t i = 0; i < a.textures.size(); ++i) {
+        const auto &ta = a.textures[i];
+        const auto &tb = b.textures[i];
+        if (ta.name != tb.name || ta.width != tb.width || ta.height != tb.height ||
+            ta.channels != tb.channels || ta.color_space != tb.color_space ||
+            ta.img != tb.img) {
+            return "texture " + ta.name;
+        }
+    }
+    if (!same_array(a.lights, b.lights)) {
+        return "lights";
+    }
+    if (!same_array(a.cameras, b.cameras)) {
+        return "cameras";
+    }
+    return "";
+}
+
+static uint32_t parse_compression(const std::string &name)
+{
+    if (name == "none") {
+        return CRTS_COMPRESSION_NONE;
+    } else if (name == "lz4") {
+        return CRTS_COMPRESSION_LZ4;
+    } else if (name == "zstd") {
+        return CRTS_COMPRESSION_ZSTD;
+    }
+    throw std::runtime_error("Unknown compression method " + name);
+}
+
+int main(int argc, const char **argv)
+{
+    const std::vector<std::string> args(argv, argv + argc);
+    auto fnd_help = std::find_if(args.begin(), args.end(), [](const std::string &a) {
+        return a == "-h" || a == "--help";
+    });
+
+    if (argc < 3 || fnd_help != args.end()) {
+        std::cout << USAGE;
+        return 1;
+    }
+
+    const std::string scene_file = args[1];
+    const std::string out_file = args[2];
+    CRTSWriteOptions options;
+    size_t merge_instance_count = 0;
+    bool optimize_meshes = false;
+    bool verify = false;
+    try {
+        for (size_t i = 3; i < args.size(); ++i) {
+            if (args[i] == "-compression") {
+                options.compression = parse_compression(args[++i]);
+            } else if (args[i] == "-compression-level") {
+                options.compression_level = std::stoi(args[++i]);
+            } else if (args[i] == "-merge-instances") {
+                merge_instance_count = std::stoul(args[++i]);
+            } else if (args[i] == "-optimize-meshes") {
+                optimize_meshes = true;
+            } else if (args[i] == "-verify") {
+                verify = true;
+            } else {
+                std::cout << "Unknown option " << args[i] << "\n" << USAGE;
+                return 1;
+            }
+        }
+        if (!crts_compression_supported(options.compression)) {
+            std::cout << "Error: The requested compression is not supported by this build\n";
+            return 1;
+        }
+
+        using namespace std::chrono;
+        auto start = high_resolution_clock::now();
+        Scene scene(scene_file);
+        if (optimize_meshes) {
+            scene.optimize_meshes();
+        }
+        if (merge_instance_count > 0) {
+            scene.merge_instances(merge_instance_count);
+        }
+        auto end = high_resolution_clock::now();
+        std::cout << "Loaded " << scene_file << " in "
+                  << duration_cast<milliseconds>(end - start).count() << "ms\n"
+                  << "# Unique Triangles: " << pretty_print_count(scene.unique_tris()) << "\n"
+                  << "# Geometries: " << scene.num_geometries() << "\n"
+                  << "# Textures: " << scene.textures.size() << "\n";
+
+        start = high_resolution_clock::now();
+        write_crts(scene, out_file, options);
+        end = high_resolution_clock::now();
+        std::cout << "Wrote " << out_file << " in "
+                  << duration_cast<milliseconds>(end - start).count() << "ms\n";
+
+        if (verify) {
+            start = high_resolution_clock::now();
+            const Scene converted(out_file);
+            end = high_resolution_clock::now();
+            std::cout << "Loaded " << out_file << " in "
+                      << duration_cast<milliseconds>(end - start).count() << "ms\n";
+
+            const std::string difference = compare_scenes(scene, converted);
+            if (!difference.empty()) {
+                std::cout << "Error: The converted scene differs from the original in its "
+                          << difference << "\n";
+                return 1;
+            }
+            std::cout << "Verified the converted scene matches the original\n";
+        }
+    } catch (const std::exception &e) {
+        std::cout << "Error: " << e.what() << "\n";
+        return 1;
+    }
+    return 0;
+}
@@ -1,5 +1,7 @@
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <numeric>
@@ -27,11 +29,65 @@ const std::string USAGE =
     "\t-camera <n>            If the scene contains multiple cameras, specify which\n"
     "\t                       should be used. Defaults to the first camera\n"
     "\t-img <x> <y>           Specify the window dimensions. Defaults to 1280x720\n"
+    "\t-scene-cache <dir>     Cache the loaded scene in the directory, to skip parsing\n"
+    "\t                       the scene file and decoding its textures in later runs\n"
+    "\t-merge-instances <n>   Bake the transforms of meshes instanced at most n times\n"
+    "\t                       and merge them into a few large meshes\n"
+    "\t-optimize-meshes       Weld duplicate vertices and reorder the triangles and\n"
+    "\t                       vertices of the meshes for better memory locality\n"
+    "\t-threads <n>           Set the number of render threads for the CPU backends.\n"
+    "\t                       Defaults to all hardware threads not reserved\n"
+    "\t-reserve-cores <n>     Leave n hardware threads free for the UI and loading\n"
+    "\t-pin-threads           Pin the CPU backend render threads to cores\n"
+    "\t-hugepages             Use huge pages for the CPU backend BVH memory\n"
+    "\t-numa                  Split rendering across the NUMA nodes, with each node's\n"
+    "\t                       threads restricted to its cores\n"
+    "\t-numa-replicate        Also replicate the scene data in each NUMA node's memory\n"
+    "\t-autotune              Find the fastest tile size and scheduling for the CPU\n"
+    "\t                       backends on the scene and save them for later runs\n"
+    "\t-path-regeneration     Have the CPU backend SIMD lanes start a new pixel's path\n"
+    "\t                       as soon as their path ends\n"
+    "\t-integrator <name>     Render with the path, albedo, normal, ao (ambient occlusion)\n"
+    "\t                       or direct (direct lighting only) integrator, if supported\n"
+    "\t                       by the backend. Defaults to path\n"
+    "\t-preview <name>        Switch to the albedo, normal, ao or direct integrator while\n"
+    "\t                       the camera is moving\n"
+    "\t-ao-samples <n>        Set the number of ambient occlusion rays per pixel sample\n"
+    "\t-dynamic-res <ms>      Lower the render resolution while the camera is moving to\n"
+    "\t                       hit the target frame time, if supported by the backend\n"
+    "\t-reproject             Keep the accumulated samples when the camera moves by\n"
+    "\t                       reprojecting them, if supported by the backend\n"
+    "\t-hit-cache <n>         Cache the primary hits of n pixel jitter patterns while\n"
+    "\t                       the camera is static, to speed up material and light edits\n"
     "\n";
 
 int win_width = 1280;
 int win_height = 720;
 
+const std::array<std::string, INTEGRATOR_COUNT> integrator_args = {
+    "path", "albedo", "normal", "ao", "direct"};
+const std::array<const char *, INTEGRATOR_COUNT> integrator_names = {
+    "Path Tracer", "Albedo", "Normal", "Ambient Occlusion", "Direct Lighting"};
+const std::array<const char *, INTEGRATOR_COUNT> preview_names = {
+    "None", "Albedo", "Normal", "Ambient Occlusion", "Direct Lighting"};
+
+bool is_textured_param(const float x)
+{
+    uint32_t bits = 0;
+    std::memcpy(&bits, &x, sizeof(float));
+    return IS_TEXTURED_PARAM(bits);
+}
+
+uint32_t parse_integrator(const std::string &name)
+{
+    auto fnd = std::find(integrator_args.begin(), integrator_args.end(), name);
+    if (fnd == integrator_args.end()) {
+        std::cout << "Error: Unknown integrator '" << name << "'\n" << USAGE;
+        std::exit(1);
+    }
+    return std::distance(integrator_args.begin(), fnd);
+}
+
 void run_app(const std::vector<std::string> &args,
              SDL_Window *window,
              Display *display,
@@ -121,6 +177,19 @@ void run_app(const std::vector<std::string> &args,
     glm::vec3 up(0, 1, 0);
     float fov_y = 65.f;
     size_t camera_id = 0;
+    std::string scene_cache_dir;
+    size_t merge_instance_count = 0;
+    bool optimize_meshes = false;
+    CPUOptions cpu_options;
+    IntegratorParams integrator;
+    // The integrator to preview with while the camera is moving, the path tracer if the
+    // selected integrator should be kept
+    uint32_t preview_integrator = INTEGRATOR_PATH_TRACER;
+    // The target frame time in milliseconds while the camera is moving, or 0 to always
+    // render at full resolution
+    float dynamic_res_target = 0.f;
+    bool reproject = false;
+    uint32_t hit_cache_patterns = 0;
     std::string validation_img_prefix;
     for (size_t i = 1; i < args.size(); ++i) {
         if (args[i] == "-eye") {
@@ -143,6 +212,41 @@ void run_app(const std::vector<std::string> &args,
             got_camera_args = true;
         } else if (args[i] == "-camera") {
             camera_id = std::stol(args[++i]);
+        } else if (args[i] == "-scene-cache") {
+            scene_cache_dir = args[++i];
+        } else if (args[i] == "-merge-instances") {
+            merge_instance_count = std::stoul(args[++i]);
+        } else if (args[i] == "-optimize-meshes") {
+            optimize_meshes = true;
+        } else if (args[i] == "-threads") {
+            cpu_options.num_threads = std::stoul(args[++i]);
+        } else if (args[i] == "-reserve-cores") {
+            cpu_options.reserved_threads = std::stoul(args[++i]);
+        } else if (args[i] == "-pin-threads") {
+            cpu_options.pin_threads = true;
+        } else if (args[i] == "-hugepages") {
+            cpu_options.huge_pages = true;
+        } else if (args[i] == "-numa") {
+            cpu_options.numa = true;
+        } else if (args[i] == "-numa-replicate") {
+            cpu_options.numa = true;
+            cpu_options.numa_replicate = true;
+        } else if (args[i] == "-autotune") {
+            cpu_options.autotune = true;
+        } else if (args[i] == "-path-regeneration") {
+            cpu_options.path_regeneration = true;
+        } else if (args[i] == "-integrator") {
+            integrator.integrator = parse_integrator(args[++i]);
+        } else if (args[i] == "-preview") {
+            preview_integrator = parse_integrator(args[++i]);
+        } else if (args[i] == "-ao-samples") {
+            integrator.ao_samples = std::max(std::stoi(args[++i]), 1);
+        } else if (args[i] == "-dynamic-res") {
+            dynamic_res_target = std::stof(args[++i]);
+        } else if (args[i] == "-reproject") {
+            reproject = true;
+        } else if (args[i] == "-hit-cache") {
+            hit_cache_patterns = std::stoi(args[++i]);
         } else if (args[i] == "-validation") {
             validation_img_prefix = args[++i];
         } else if (args[i] == "-img") {
@@ -164,12 +268,31 @@ void run_app(const std::vector<std::string> &args,
         std::exit(1);
     }
 
+    const CPUTopology cpu_topology = get_cpu_topology();
+    std::cout << "CPU: " << cpu_topology.to_string() << "\n";
+    renderer->set_cpu_options(cpu_options);
+
     display->resize(win_width, win_height);
     renderer->initialize(win_width, win_height);
 
     std::string scene_info;
+    // Copies of the scene's materials and lights for editing them in the UI
+    std::vector<DisneyMaterial> materials;
+    std::vector<QuadLight> lights;
     {
-        Scene scene(scene_file);
+        Scene scene(scene_file, scene_cache_dir);
+        if (optimize_meshes) {
+            scene.optimize_meshes();
+        }
+        if (merge_instance_count > 0) {
+            scene.merge_instances(merge_instance_count);
+        }
+        if (scene.instance_levels() > renderer->max_instance_levels()) {
+            std::cout << "Scene has " << scene.instance_levels() << " instancing levels but "
+                      << renderer->name() << " supports " << renderer->max_instance_levels()
+                      << ", flattening instance groups\n";
+            scene.flatten_instance_groups();
+        }
 
         std::stringstream ss;
         ss << "Scene '" << scene_file << "':\n"
@@ -179,6 +302,8 @@ void run_app(const std::vector<std::string> &args,
            << "# Meshes: " << scene.meshes.size() << "\n"
            << "# Parameterized Meshes: " << scene.parameterized_meshes.size() << "\n"
            << "# Instances: " << scene.instances.size() << "\n"
+           << "# Instance Groups: " << scene.instance_groups.size() << "\n"
+           << "# Group Instances: " << scene.group_instances.size() << "\n"
            << "# Materials: " << scene.materials.size() << "\n"
            << "# Textures: " << scene.textures.size() << "\n"
            << "# Lights: " << scene.lights.size() << "\n"
@@ -188,6 +313,8 @@ void run_app(const std::vector<std::string> &args,
         std::cout << scene_info << "\n";
 
         renderer->set_scene(scene);
+        materials = scene.materials;
+        lights = scene.lights;
 
         if (!got_camera_args && !scene.cameras.empty()) {
             eye = scene.cameras[camera_id].position;
@@ -199,8 +326,47 @@ void run_app(const std::vector<std::string> &args,
 
     ArcballCamera camera(eye, center, up);
 
+    const bool integrators_supported = renderer->set_integrator(integrator);
+    if (!integrators_supported && integrator.integrator != INTEGRATOR_PATH_TRACER) {
+        std::cout << "Warning: " << renderer->name()
+                  << " only supports the path tracer, ignoring -integrator\n";
+    }
+    IntegratorParams active_integrator = integrator;
+
+    const bool dynamic_res_supported = renderer->set_render_scale(1.f);
+    if (!dynamic_res_supported && dynamic_res_target > 0.f) {
+        std::cout << "Warning: " << renderer->name()
+                  << " doesn't support dynamic resolution, ignoring -dynamic-res\n";
+    }
+    bool dynamic_res = dynamic_res_supported && dynamic_res_target > 0.f;
+    if (dynamic_res_target <= 0.f) {
+        dynamic_res_target = 33.f;
+    }
+    const bool reprojection_supported = renderer->set_temporal_reprojection(reproject);
+    if (!reprojection_supported && reproject) {
+        std::cout << "Warning: " << renderer->name()
+                  << " doesn't support temporal reprojection, ignoring -reproject\n";
+    }
+
+    if (hit_cache_patterns > 0 && !renderer->set_primary_hit_cache(hit_cache_patterns)) {
+        std::cout << "Warning: " << renderer->name()
+                  << " doesn't support caching primary hits, ignoring -hit-cache\n";
+    }
+    // Materials and lights can only be edited if the backend can update them in place
+    const bool materials_editable = renderer->update_materials(materials);
+    const bool lights_editable = renderer->update_lights(lights);
+    int edit_material = 0;
+    int edit_light = 0;
+
+    // The resolution scale used while moving, adapted to the frame times measured while
+    // moving, and the scale the renderer is currently using
+    float motion_scale = 1.f;
+    float active_scale = 1.f;
+
+    auto last_camera_motion = std::chrono::steady_clock::now() - std::chrono::seconds(1);
+
     const std::string rt_backend = renderer->name();
-    const std::string cpu_brand = get_cpu_brand();
+    const std::string cpu_brand = cpu_topology.to_string();
     const std::string gpu_brand = display->gpu_brand();
     const std::string image_output = "chameleonrt.png";
     const std::string display_frontend = display->name();
@@ -270,6 +436,39 @@ void run_app(const std::vector<std::string> &args,
             }
         }
 
+        // The camera is treated as moving until it has been still for a moment, so the
+        // previews aren't interrupted by frames without input events
+        const auto now = std::chrono::steady_clock::now();
+        if (camera_changed) {
+            last_camera_motion = now;
+        }
+        const bool camera_moving = now - last_camera_motion < std::chrono::milliseconds(150);
+
+        // Render with the preview integrator and at the reduced resolution while moving,
+        // restarting accumulation whenever the integrator or resolution change
+        if (integrators_supported) {
+            IntegratorParams params = integrator;
+            if (preview_integrator != INTEGRATOR_PATH_TRACER && camera_moving) {
+                params.integrator = preview_integrator;
+            }
+            if (params.integrator != active_integrator.integrator ||
+                params.ao_samples != active_integrator.ao_samples ||
+                params.ao_radius != active_integrator.ao_radius) {
+                renderer->set_integrator(params);
+                active_integrator = params;
+                camera_changed = true;
+            }
+        }
+
+        if (dynamic_res_supported) {
+            const float scale = dynamic_res && camera_moving ? motion_scale : 1.f;
+            if (scale != active_scale) {
+                renderer->set_render_scale(scale);
+                active_scale = scale;
+                camera_changed = true;
+            }
+        }
+
         if (camera_changed) {
             frame_id = 0;
         }
@@ -281,6 +480,16 @@ void run_app(const std::vector<std::string> &args,
         ++frame_id;
         camera_changed = false;
 
+        // The render time scales with the pixel count, so scale each axis by the square root
+        // of the ratio to the target time. The scale is quantized to avoid resizing the
+        // render every frame over small variations in the render time
+        if (dynamic_res && camera_moving && stats.render_time > 0.f) {
+            const float ratio = dynamic_res_target / stats.render_time;
+            const float scale =
+                glm::clamp(active_scale * std::sqrt(ratio), MIN_RENDER_SCALE, 1.f);
+            motion_scale = std::round(scale * 16.f) / 16.f;
+        }
+
         if (save_image) {
             save_image = false;
             std::cout << "Image saved to " << image_output << "\n";
@@ -335,6 +544,72 @@ void run_app(const std::vector<std::string> &args,
         ImGui::Text("Display Frontend: %s", display_frontend.c_str());
         ImGui::Text("%s", scene_info.c_str());
 
+        if (integrators_supported) {
+            int selected = integrator.integrator;
+            if (ImGui::Combo("Integrator",
+                             &selected,
+                             integrator_names.data(),
+                             integrator_names.size())) {
+                integrator.integrator = selected;
+            }
+            int preview = preview_integrator;
+            if (ImGui::Combo("Preview While Moving",
+                             &preview,
+                             preview_names.data(),
+                             preview_names.size())) {
+                preview_integrator = preview;
+            }
+            int ao_samples = integrator.ao_samples;
+            if (ImGui::SliderInt("AO Samples", &ao_samples, 1, 64)) {
+                integrator.ao_samples = ao_samples;
+            }
+            ImGui::SliderFloat("AO Radius", &integrator.ao_radius, 0.001f, 1.f);
+        }
+        if (dynamic_res_supported) {
+            ImGui::Checkbox("Dynamic Resolution", &dynamic_res);
+            ImGui::SliderFloat("Target Frame Time (ms)", &dynamic_res_target, 5.f, 100.f);
+            ImGui::Text("Render Scale: %.0f%%", active_scale * 100.f);
+        }
+        if (reprojection_supported && ImGui::Checkbox("Temporal Reprojection", &reproject)) {
+            renderer->set_temporal_reprojection(reproject);
+            camera_changed = true;
+        }
+
+        if (materials_editable && !materials.empty() && ImGui::CollapsingHeader("Materials")) {
+            ImGui::SliderInt("Material", &edit_material, 0, materials.size() - 1);
+            auto &mat = materials[edit_material];
+            // Textured parameters store the texture handle and can't be edited
+            auto edit_param = [](const char *label, float &x, const float lo, const float hi) {
+                return !is_textured_param(x) && ImGui::SliderFloat(label, &x, lo, hi);
+            };
+            bool changed = false;
+            if (!is_textured_param(mat.base_color.r)) {
+                changed |= ImGui::ColorEdit3("Base Color", &mat.base_color.x);
+            }
+            changed |= edit_param("Metallic", mat.metallic, 0.f, 1.f);
+            changed |= edit_param("Specular", mat.specular, 0.f, 1.f);
+            changed |= edit_param("Roughness", mat.roughness, 0.f, 1.f);
+            changed |= edit_param("Specular Tint", mat.specular_tint, 0.f, 1.f);
+            changed |= edit_param("Anisotropy", mat.anisotropy, 0.f, 1.f);
+            changed |= edit_param("Sheen", mat.sheen, 0.f, 1.f);
+            changed |= edit_param("Sheen Tint", mat.sheen_tint, 0.f, 1.f);
+            changed |= edit_param("Clearcoat", mat.clearcoat, 0.f, 1.f);
+            changed |= edit_param("Clearcoat Gloss", mat.clearcoat_gloss, 0.f, 1.f);
+            changed |= edit_param("IOR", mat.ior, 1.f, 3.f);
+            changed |= edit_param("Transmission", mat.specular_transmission, 0.f, 1.f);
+            if (changed) {
+                renderer->update_materials(materials);
+                frame_id = 0;
+            }
+        }
+        if (lights_editable && !lights.empty() && ImGui::CollapsingHeader("Lights")) {
+            ImGui::SliderInt("Light", &edit_light, 0, lights.size() - 1);
+            if (ImGui::DragFloat3("Emission", &lights[edit_light].emission.x, 0.1f, 0.f)) {
+                renderer->update_lights(lights);
+                frame_id = 0;
+            }
+        }
+
         if (ImGui::Button("Save Image")) {
             save_image = true;
         }
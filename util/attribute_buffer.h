@@ -0,0 +1,129 @@
+#pragma once
+
+#include <memory>
+#include <utility>
+#include <vector>
+
+/* An array of geometry attributes which either owns its data, or references an external
+ * buffer such as a view into a memory mapped scene file. The external buffer is kept alive
+ * by a shared pointer to its owner, so geometry can be copied around and passed to the
+ * backends without copying the data. External buffers must be aligned for T and followed by
+ * at least 16 readable bytes, so that they can be shared with APIs which read the last
+ * element with vector loads (e.g., Embree vertex buffers).
+ *
+ * Reads never copy the data. External buffers are read-only: modifying one through the
+ * mutating methods first copies it into owned storage.
+ */
+template <typename T>
+class AttributeBuffer {
+    std::vector<T> owned;
+    const T *external = nullptr;
+    size_t external_size = 0;
+    std::shared_ptr<const void> external_owner;
+
+    // Copy the external buffer into owned storage, so it can be modified
+    void make_owned()
+    {
+        if (external) {
+            owned = std::vector<T>(external, external + external_size);
+            external = nullptr;
+            external_size = 0;
+            external_owner = nullptr;
+        }
+    }
+
+public:
+    using value_type = T;
+
+    AttributeBuffer() = default;
+
+    AttributeBuffer(const std::vector<T> &data) : owned(data) {}
+
+    AttributeBuffer(std::vector<T> &&data) : owned(std::move(data)) {}
+
+    // Reference the external buffer of size elements, which is kept alive by the owner
+    AttributeBuffer(const T *data, const size_t size, std::shared_ptr<const void> owner)
+        : external(data), external_size(size), external_owner(std::move(owner))
+    {
+    }
+
+    bool is_external() const
+    {
+        return external != nullptr;
+    }
+
+    // The owner of the external buffer, or null if the buffer owns its data
+    const std::shared_ptr<const void> &owner() const
+    {
+        return external_owner;
+    }
+
+    size_t size() const
+    {
+        return external ? external_size : owned.size();
+    }
+
+    bool empty() const
+    {
+        return size() == 0;
+    }
+
+    const T *data() const
+    {
+        return external ? external : owned.data();
+    }
+
+    const T *begin() const
+    {
+        return data();
+    }
+
+    const T *end() const
+    {
+        return data() + size();
+    }
+
+    const T &operator[](const size_t i) const
+    {
+        return data()[i];
+    }
+
+    T *mutable_data()
+    {
+        make_owned();
+        return owned.data();
+    }
+
+    void push_back(const T &x)
+    {
+        make_owned();
+        owned.push_back(x);
+    }
+
+    template <typename... Args>
+    void emplace_back(Args &&... args)
+    {
+        make_owned();
+        owned.emplace_back(std::forward<Args>(args)...);
+    }
+
+    void reserve(const size_t n)
+    {
+        make_owned();
+        owned.reserve(n);
+    }
+
+    void resize(const size_t n)
+    {
+        make_owned();
+        owned.resize(n);
+    }
+
+    void clear()
+    {
+        owned.clear();
+        external = nullptr;
+        external_size = 0;
+        external_owner = nullptr;
+    }
+};
@@ -1,5 +1,8 @@
 #include "buffer_view.h"
+#include <algorithm>
 #include <cmath>
+#include <limits>
+#include <stdexcept>
 
 BufferView::BufferView(const tinygltf::BufferView &view,
                        const tinygltf::Model &model,
@@ -20,3 +23,160 @@ const uint8_t *BufferView::operator[](const size_t i) const
     return buf + i * stride;
 }
 
+
+BufferView gltf_accessor_view(const tinygltf::Accessor &accessor,
+                              const tinygltf::Model &model)
+{
+    if (accessor.sparse.isSparse) {
+        throw std::runtime_error("Sparse glTF accessors are not supported");
+    }
+    if (accessor.bufferView < 0 || size_t(accessor.bufferView) >= model.bufferViews.size()) {
+        throw std::runtime_error("glTF accessor has no valid buffer view");
+    }
+    const tinygltf::BufferView &view = model.bufferViews[accessor.bufferView];
+    if (view.buffer < 0 || size_t(view.buffer) >= model.buffers.size() ||
+        view.byteOffset > model.buffers[view.buffer].data.size() ||
+        view.byteLength > model.buffers[view.buffer].data.size() - view.byteOffset) {
+        throw std::runtime_error("glTF buffer view is out of bounds of its buffer");
+    }
+
+    const size_t elem_size = gltf_base_stride(accessor.type, accessor.componentType);
+    BufferView accessor_view(view, model, elem_size);
+    if (accessor.count > 0 &&
+        (accessor.byteOffset > view.byteLength ||
+         elem_size > view.byteLength - accessor.byteOffset ||
+         accessor.count - 1 >
+             (view.byteLength - accessor.byteOffset - elem_size) / accessor_view.stride)) {
+        throw std::runtime_error("glTF accessor is out of bounds of its buffer view");
+    }
+    // Apply the additional accessor-specific byte offset
+    accessor_view.buf += accessor.byteOffset;
+    accessor_view.length = view.byteLength - std::min(view.byteLength, accessor.byteOffset);
+    return accessor_view;
+}
+
+/* Convert the components of the view's elements to float, scaling them by scale and
+ * clamping them to min_value, which is -1 for signed normalized components. Tightly packed
+ * views are converted in a single loop over the components, which the compiler vectorizes
+ */
+template <typename C>
+static void convert_components(const BufferView &view,
+                               const size_t count,
+                               const size_t num_components,
+                               const float scale,
+                               const float min_value,
+                               float *out)
+{
+    if (view.stride == num_components * sizeof(C)) {
+        const C *in = reinterpret_cast<const C *>(view.buf);
+        const size_t n = count * num_components;
+        for (size_t i = 0; i < n; ++i) {
+            out[i] = std::max(in[i] * scale, min_value);
+        }
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            const C *in = reinterpret_cast<const C *>(view[i]);
+            for (size_t c = 0; c < num_components; ++c) {
+                out[i * num_components + c] = std::max(in[c] * scale, min_value);
+            }
+        }
+    }
+}
+
+// Convert integer components, which are mapped to [0, 1] or [-1, 1] if normalized
+template <typename C>
+static void convert_integer_components(const BufferView &view,
+                                       const size_t count,
+                                       const size_t num_components,
+                                       const bool normalized,
+                                       float *out)
+{
+    const float scale = normalized ? 1.f / std::numeric_limits<C>::max() : 1.f;
+    const float min_value = normalized && std::numeric_limits<C>::is_signed
+                                ? -1.f
+                                : float(std::numeric_limits<C>::lowest());
+    convert_components<C>(view, count, num_components, scale, min_value, out);
+}
+
+void read_gltf_floats(const tinygltf::Accessor &accessor,
+                      const tinygltf::Model &model,
+                      const size_t num_components,
+                      float *out)
+{
+    const DTYPE dtype = gltf_type_to_dtype(accessor.type, accessor.componentType);
+    if (dtype_components(dtype) != num_components) {
+        throw std::runtime_error("glTF accessor has " + print_data_type(dtype) +
+                                 " elements, expected " + std::to_string(num_components) +
+                                 " components");
+    }
+    const BufferView view = gltf_accessor_view(accessor, model);
+    const size_t count = accessor.count;
+    switch (accessor.componentType) {
+    case TINYGLTF_COMPONENT_TYPE_FLOAT:
+        if (count > 0 && view.stride == num_components * sizeof(float)) {
+            std::memcpy(out, view.buf, count * num_components * sizeof(float));
+        } else {
+            convert_components<float>(
+                view, count, num_components, 1.f, std::numeric_limits<float>::lowest(), out);
+        }
+        break;
+    case TINYGLTF_COMPONENT_TYPE_BYTE:
+        convert_integer_components<int8_t>(
+            view, count, num_components, accessor.normalized, out);
+        break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE:
+        convert_integer_components<uint8_t>(
+            view, count, num_components, accessor.normalized, out);
+        break;
+    case TINYGLTF_COMPONENT_TYPE_SHORT:
+        convert_integer_components<int16_t>(
+            view, count, num_components, accessor.normalized, out);
+        break;
+    case TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT:
+        convert_integer_components<uint16_t>(
+            view, count, num_components, accessor.normalized, out);
+        break;
+    default:
+        throw std::runtime_error("Unsupported glTF accessor component type " +
+                                 std::to_string(accessor.componentType));
+    }
+}
+
+template <typename I>
+static void convert_indices(const BufferView &view, const size_t count, uint32_t *out)
+{
+    if (view.stride == sizeof(I)) {
+        const I *in = reinterpret_cast<const I *>(view.buf);
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = in[i];
+        }
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            out[i] = *reinterpret_cast<const I *>(view[i]);
+        }
+    }
+}
+
+void read_gltf_indices(const tinygltf::Accessor &accessor,
+                       const tinygltf::Model &model,
+                       uint32_t *out)
+{
+    if (accessor.type != TINYGLTF_TYPE_SCALAR) {
+        throw std::runtime_error("glTF index accessors must be scalars");
+    }
+    const BufferView view = gltf_accessor_view(accessor, model);
+    if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
+        convert_indices<uint8_t>(view, accessor.count, out);
+    } else if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
+        convert_indices<uint16_t>(view, accessor.count, out);
+    } else if (accessor.componentType == TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) {
+        if (accessor.count > 0 && view.stride == sizeof(uint32_t)) {
+            std::memcpy(out, view.buf, accessor.count * sizeof(uint32_t));
+        } else {
+            convert_indices<uint32_t>(view, accessor.count, out);
+        }
+    } else {
+        throw std::runtime_error("Unsupported glTF index component type " +
+                                 std::to_string(accessor.componentType));
+    }
+}
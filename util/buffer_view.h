@@ -1,5 +1,7 @@
 #pragma once
 
+#include <cstring>
+#include <stdexcept>
 #include "gltf_types.h"
 #include "tiny_gltf.h"
 
@@ -22,6 +24,29 @@ struct BufferView {
     const uint8_t *operator[](const size_t i) const;
 };
 
+/* Get the view of the accessor's elements, starting at its first element. Throws a
+ * std::runtime_error if the accessor is sparse, or if its elements aren't within its buffer
+ */
+BufferView gltf_accessor_view(const tinygltf::Accessor &accessor,
+                              const tinygltf::Model &model);
+
+/* Read the accessor's elements into out as num_components floats each, out must hold
+ * accessor.count * num_components floats. Float accessors are copied in bulk. Byte and short
+ * accessors, which KHR_mesh_quantization allows for positions, normals and texcoords, are
+ * dequantized: normalized ones are mapped to [0, 1] or [-1, 1], others converted as is
+ */
+void read_gltf_floats(const tinygltf::Accessor &accessor,
+                      const tinygltf::Model &model,
+                      const size_t num_components,
+                      float *out);
+
+/* Read the accessor's unsigned byte, short or int indices into out, which must hold
+ * accessor.count indices
+ */
+void read_gltf_indices(const tinygltf::Accessor &accessor,
+                       const tinygltf::Model &model,
+                       uint32_t *out);
+
 template <typename T>
 class Accessor {
     BufferView view;
@@ -42,17 +67,17 @@ public:
     const T *end() const;
 
     size_t size() const;
+
+    /* Copy the elements to out, which must hold size() elements. Tightly packed buffers are
+     * copied with a single memcpy
+     */
+    void copy_to(T *out) const;
 };
 
 template <typename T>
 Accessor<T>::Accessor(const tinygltf::Accessor &accessor, const tinygltf::Model &model)
-    : view(model.bufferViews[accessor.bufferView],
-           model,
-           gltf_base_stride(accessor.type, accessor.componentType)),
-      count(accessor.count)
+    : view(gltf_accessor_view(accessor, model)), count(accessor.count)
 {
-    // Apply the additional accessor-specific byte offset
-    view.buf += accessor.byteOffset;
 }
 
 template <typename T>
@@ -89,3 +114,18 @@ size_t Accessor<T>::size() const
 {
     return count;
 }
+
+template <typename T>
+void Accessor<T>::copy_to(T *out) const
+{
+    if (count == 0) {
+        return;
+    }
+    if (view.stride == sizeof(T)) {
+        std::memcpy(out, view.buf, count * sizeof(T));
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            std::memcpy(out + i, view[i], sizeof(T));
+        }
+    }
+}
@@ -0,0 +1,370 @@
+#include "crts.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <glm/gtc/type_ptr.hpp>
+#include "scene.h"
+#include "util.h"
+
+#ifdef CRTS_LZ4_ENABLED
+#include <lz4.h>
+#endif
+#ifdef CRTS_ZSTD_ENABLED
+#include <zstd.h>
+#endif
+
+const char CRTS_V2_MAGIC[8] = {'C', 'R', 'T', 'S', 'v', '2', '\0', '\0'};
+
+bool crts_compression_supported(const uint32_t compression)
+{
+    switch (compression) {
+    case CRTS_COMPRESSION_NONE:
+        return true;
+#ifdef CRTS_LZ4_ENABLED
+    case CRTS_COMPRESSION_LZ4:
+        return true;
+#endif
+#ifdef CRTS_ZSTD_ENABLED
+    case CRTS_COMPRESSION_ZSTD:
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+void crts_decompress(const uint32_t compression,
+                     const uint8_t *data,
+                     const uint64_t size,
+                     uint8_t *out,
+                     const uint64_t uncompressed_size)
+{
+#if !defined(CRTS_LZ4_ENABLED) && !defined(CRTS_ZSTD_ENABLED)
+    (void)data;
+    (void)size;
+    (void)out;
+    (void)uncompressed_size;
+#endif
+    switch (compression) {
+#ifdef CRTS_LZ4_ENABLED
+    case CRTS_COMPRESSION_LZ4: {
+        if (size > INT32_MAX || uncompressed_size > INT32_MAX) {
+            throw std::runtime_error("LZ4 CRTS buffer view is too large");
+        }
+        const int n = LZ4_decompress_safe(reinterpret_cast<const char *>(data),
+                                          reinterpret_cast<char *>(out),
+                                          int(size),
+                                          int(uncompressed_size));
+        if (n < 0 || uint64_t(n) != uncompressed_size) {
+            throw std::runtime_error("Failed to decompress LZ4 CRTS buffer view");
+        }
+        break;
+    }
+#endif
+#ifdef CRTS_ZSTD_ENABLED
+    case CRTS_COMPRESSION_ZSTD: {
+        const size_t n = ZSTD_decompress(out, uncompressed_size, data, size);
+        if (ZSTD_isError(n) || n != uncompressed_size) {
+            throw std::runtime_error("Failed to decompress zstd CRTS buffer view");
+        }
+        break;
+    }
+#endif
+    default:
+        throw std::runtime_error("Unsupported CRTS buffer view compression " +
+                                 std::to_string(compression));
+    }
+}
+
+/* Compress the data, returning false if the compressed data isn't smaller, in which case
+ * the view is stored uncompressed
+ */
+static bool crts_compress(const uint32_t compression,
+                          const int level,
+                          const uint8_t *data,
+                          const uint64_t size,
+                          std::vector<uint8_t> &out)
+{
+#if !defined(CRTS_LZ4_ENABLED) && !defined(CRTS_ZSTD_ENABLED)
+    (void)level;
+    (void)data;
+    (void)size;
+    (void)out;
+#endif
+    switch (compression) {
+    case CRTS_COMPRESSION_NONE:
+        return false;
+#ifdef CRTS_LZ4_ENABLED
+    case CRTS_COMPRESSION_LZ4: {
+        if (size > LZ4_MAX_INPUT_SIZE) {
+            return false;
+        }
+        out.resize(LZ4_compressBound(int(size)));
+        const int n = LZ4_compress_fast(reinterpret_cast<const char *>(data),
+                                        reinterpret_cast<char *>(out.data()),
+                                        int(size),
+                                        int(out.size()),
+                                        std::max(level, 1));
+        if (n <= 0 || uint64_t(n) >= size) {
+            return false;
+        }
+        out.resize(n);
+        return true;
+    }
+#endif
+#ifdef CRTS_ZSTD_ENABLED
+    case CRTS_COMPRESSION_ZSTD: {
+        out.resize(ZSTD_compressBound(size));
+        const size_t n = ZSTD_compress(out.data(), out.size(), data, size, level);
+        if (ZSTD_isError(n) || n >= size) {
+            return false;
+        }
+        out.resize(n);
+        return true;
+    }
+#endif
+    default:
+        throw std::runtime_error("Unsupported CRTS buffer view compression " +
+                                 std::to_string(compression));
+    }
+}
+
+static uint64_t align_crts_offset(const uint64_t offset)
+{
+    return (offset + CRTS_ALIGNMENT - 1) / CRTS_ALIGNMENT * CRTS_ALIGNMENT;
+}
+
+// The data of a buffer view, compressed if it got smaller
+struct CRTSWriteView {
+    const uint8_t *data = nullptr;
+    uint64_t size = 0;
+    std::vector<uint8_t> compressed;
+    uint32_t compression = CRTS_COMPRESSION_NONE;
+};
+
+static uint32_t add_view(std::vector<CRTSWriteView> &views,
+                         const void *data,
+                         const size_t size)
+{
+    CRTSWriteView view;
+    view.data = reinterpret_cast<const uint8_t *>(data);
+    view.size = size;
+    views.push_back(std::move(view));
+    return views.size() - 1;
+}
+
+template <typename T>
+static uint32_t add_attribute_view(std::vector<CRTSWriteView> &views,
+                                   const AttributeBuffer<T> &attrib)
+{
+    if (attrib.empty()) {
+        return CRTS_NO_VIEW;
+    }
+    return add_view(views, attrib.data(), attrib.size() * sizeof(T));
+}
+
+static CRTSInstance make_crts_instance(const glm::mat4 &transform, const size_t id)
+{
+    CRTSInstance inst = {};
+    std::memcpy(inst.transform, glm::value_ptr(transform), sizeof(inst.transform));
+    inst.id = id;
+    return inst;
+}
+
+// Tracks the layout of the tables while writing the file
+class CRTSWriter {
+    std::ofstream &fout;
+    uint64_t offset = 0;
+
+    void pad_to(const uint64_t target)
+    {
+        static const char zeros[CRTS_ALIGNMENT] = {0};
+        while (offset < target) {
+            const uint64_t n = std::min(target - offset, uint64_t(CRTS_ALIGNMENT));
+            fout.write(zeros, n);
+            offset += n;
+        }
+    }
+
+public:
+    CRTSWriter(std::ofstream &fout) : fout(fout) {}
+
+    uint64_t write(const void *data, const uint64_t size)
+    {
+        pad_to(align_crts_offset(offset));
+        const uint64_t start = offset;
+        fout.write(reinterpret_cast<const char *>(data), size);
+        offset += size;
+        return start;
+    }
+
+    template <typename T>
+    CRTSTable write_table(const std::vector<T> &table)
+    {
+        CRTSTable t;
+        t.offset = write(table.data(), table.size() * sizeof(T));
+        t.count = table.size();
+        return t;
+    }
+
+    // Pad the end of the file so views can be used in place
+    void finish()
+    {
+        pad_to(align_crts_offset(offset) + CRTS_ALIGNMENT);
+    }
+};
+
+void write_crts(const Scene &scene, const std::string &file, const CRTSWriteOptions &options)
+{
+    if (!crts_compression_supported(options.compression)) {
+        throw std::runtime_error("CRTS compression " + std::to_string(options.compression) +
+                                 " is not supported by this build");
+    }
+
+    std::vector<CRTSWriteView> views;
+    std::vector<CRTSGeometry> geometries;
+    std::vector<CRTSMesh> meshes;
+    for (const auto &m : scene.meshes) {
+        CRTSMesh mesh;
+        mesh.first_geometry = geometries.size();
+        mesh.num_geometries = m.geometries.size();
+        for (const auto &g : m.geometries) {
+            CRTSGeometry geom;
+            geom.positions_view = add_view(
+                views, g.vertices.data(), g.vertices.size() * sizeof(glm::vec3));
+            geom.indices_view =
+                add_view(views, g.indices.data(), g.indices.size() * sizeof(glm::uvec3));
+            geom.texcoords_view = add_attribute_view(views, g.uvs);
+            geom.normals_view = add_attribute_view(views, g.normals);
+            geom.grid_dims[0] = g.grid_dims.x;
+            geom.grid_dims[1] = g.grid_dims.y;
+            geometries.push_back(geom);
+        }
+        meshes.push_back(mesh);
+    }
+
+    std::vector<CRTSParameterizedMesh> parameterized_meshes;
+    std::vector<uint32_t> material_ids;
+    for (const auto &pm : scene.parameterized_meshes) {
+        if (pm.material_ids.size() != scene.meshes[pm.mesh_id].geometries.size()) {
+            throw std::runtime_error(
+                "Parameterized mesh material IDs do not match its mesh geometries");
+        }
+        CRTSParameterizedMesh p;
+        p.mesh = pm.mesh_id;
+        p.first_material_id = material_ids.size();
+        material_ids.insert(
+            material_ids.end(), pm.material_ids.begin(), pm.material_ids.end());
+        parameterized_meshes.push_back(p);
+    }
+
+    std::vector<CRTSInstance> instances;
+    std::vector<CRTSInstance> group_instances;
+    for (const auto &inst : scene.instances) {
+        instances.push_back(make_crts_instance(inst.transform, inst.parameterized_mesh_id));
+    }
+    for (const auto &inst : scene.group_instances) {
+        group_instances.push_back(make_crts_instance(inst.transform, inst.group_id));
+    }
+    std::vector<CRTSInstanceGroup> instance_groups;
+    for (const auto &g : scene.instance_groups) {
+        CRTSInstanceGroup group;
+        group.first_instance = instances.size();
+        group.num_instances = g.instances.size();
+        group.first_group_instance = group_instances.size();
+        group.num_group_instances = g.group_instances.size();
+        for (const auto &inst : g.instances) {
+            instances.push_back(
+                make_crts_instance(inst.transform, inst.parameterized_mesh_id));
+        }
+        for (const auto &inst : g.group_instances) {
+            group_instances.push_back(make_crts_instance(inst.transform, inst.group_id));
+        }
+        instance_groups.push_back(group);
+    }
+
+    std::vector<CRTSImage> images;
+    std::vector<char> strings;
+    for (const auto &t : scene.textures) {
+        if (t.channels != 4) {
+            throw std::runtime_error("CRTS textures must be RGBA8, but " + t.name + " has " +
+                                     std::to_string(t.channels) + " channels");
+        }
+        CRTSImage img = {};
+        img.view = add_view(views, t.img.data(), t.img.size());
+        img.format = CRTS_IMAGE_RGBA8;
+        img.width = t.width;
+        img.height = t.height;
+        img.color_space = t.color_space;
+        img.name_offset = strings.size();
+        img.name_size = t.name.size();
+        strings.insert(strings.end(), t.name.begin(), t.name.end());
+        images.push_back(img);
+    }
+
+    parallel_for(0, views.size(), [&](const size_t i) {
+        CRTSWriteView &view = views[i];
+        if (crts_compress(options.compression,
+                          options.compression_level,
+                          view.data,
+                          view.size,
+                          view.compressed)) {
+            view.compression = options.compression;
+        } else {
+            view.compressed = std::vector<uint8_t>();
+        }
+    });
+
+    std::ofstream fout(file.c_str(), std::ios::binary);
+    if (!fout) {
+        throw std::runtime_error("Failed to open " + file + " for writing");
+    }
+    CRTSWriter writer(fout);
+    CRTSHeader header = {};
+    std::memcpy(header.magic, CRTS_V2_MAGIC, sizeof(CRTS_V2_MAGIC));
+    header.version = CRTS_V2_VERSION;
+    // The tables are filled in once the rest of the file is written
+    writer.write(&header, sizeof(header));
+
+    header.geometries = writer.write_table(geometries);
+    header.meshes = writer.write_table(meshes);
+    header.parameterized_meshes = writer.write_table(parameterized_meshes);
+    header.material_ids = writer.write_table(material_ids);
+    header.instances = writer.write_table(instances);
+    header.instance_groups = writer.write_table(instance_groups);
+    header.group_instances = writer.write_table(group_instances);
+    header.materials = writer.write_table(scene.materials);
+    header.images = writer.write_table(images);
+    header.lights = writer.write_table(scene.lights);
+    header.cameras = writer.write_table(scene.cameras);
+    header.strings = writer.write_table(strings);
+    header.num_top_level_instances = scene.instances.size();
+    header.num_top_level_group_instances = scene.group_instances.size();
+
+    std::vector<CRTSBufferView> buffer_views;
+    for (const auto &v : views) {
+        CRTSBufferView view = {};
+        view.compression = v.compression;
+        view.uncompressed_size = v.size;
+        if (v.compression == CRTS_COMPRESSION_NONE) {
+            view.size = v.size;
+            view.offset = writer.write(v.data, v.size);
+        } else {
+            view.size = v.compressed.size();
+            view.offset = writer.write(v.compressed.data(), v.compressed.size());
+        }
+        buffer_views.push_back(view);
+    }
+    header.views = writer.write_table(buffer_views);
+    writer.finish();
+
+    fout.seekp(0);
+    fout.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    if (!fout) {
+        throw std::runtime_error("Failed to write " + file);
+    }
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/* CRTS v2 is a binary scene format which can be loaded without parsing, and mirrors the
+ * Scene representation so scenes converted to it load back exactly. The file starts with a
+ * CRTSHeader, which gives the offset and size of each table. Every table and buffer view
+ * starts at a 64 byte aligned offset, and the file is padded with 64 bytes after the last
+ * view so that views can be used in place (see AttributeBuffer).
+ *
+ * Buffer views can be compressed individually with LZ4 or zstd, in which case they're
+ * decompressed in parallel while loading. Textures are stored either encoded (PNG, JPEG,
+ * etc., decoded with stb_image) or as pre-decoded RGBA8 data, which is loaded directly.
+ *
+ * CRTS v1 files start with the size of their JSON header instead, which can't match the
+ * v2 magic number.
+ */
+
+#define CRTS_V2_VERSION 2
+#define CRTS_ALIGNMENT 64
+// Marks a missing optional buffer view
+#define CRTS_NO_VIEW 0xffffffff
+
+enum CRTSCompression : uint32_t {
+    CRTS_COMPRESSION_NONE = 0,
+    CRTS_COMPRESSION_LZ4 = 1,
+    CRTS_COMPRESSION_ZSTD = 2
+};
+
+enum CRTSImageFormat : uint32_t {
+    // An image file (PNG, JPEG, etc.), flipped vertically after decoding as in CRTS v1
+    CRTS_IMAGE_ENCODED = 0,
+    // Decoded RGBA8 pixels, stored in the orientation used by the renderer
+    CRTS_IMAGE_RGBA8 = 1
+};
+
+extern const char CRTS_V2_MAGIC[8];
+
+struct CRTSTable {
+    uint64_t offset;
+    uint64_t count;
+};
+
+/* The tables of the scene. Materials, lights and cameras are stored as DisneyMaterial,
+ * QuadLight and Camera, with textured material parameters encoded as described in
+ * texture_channel_mask.h. The top-level instances and group instances come first in their
+ * tables, followed by those of the instance groups
+ */
+struct CRTSHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pad;
+
+    CRTSTable views;
+    CRTSTable geometries;
+    CRTSTable meshes;
+    CRTSTable parameterized_meshes;
+    CRTSTable material_ids;
+    CRTSTable instances;
+    CRTSTable instance_groups;
+    CRTSTable group_instances;
+    CRTSTable materials;
+    CRTSTable images;
+    CRTSTable lights;
+    CRTSTable cameras;
+    // Characters of the image names
+    CRTSTable strings;
+
+    uint64_t num_top_level_instances;
+    uint64_t num_top_level_group_instances;
+};
+
+struct CRTSBufferView {
+    uint64_t offset;
+    // The size of the data in the file, and once decompressed
+    uint64_t size;
+    uint64_t uncompressed_size;
+    uint32_t compression;
+    uint32_t pad;
+};
+
+/* The positions are vec3s, the indices uvec3s, the texcoords vec2s and the normals vec3s.
+ * The indices are optional for grid geometries, marked with non-zero grid dimensions
+ */
+struct CRTSGeometry {
+    uint32_t positions_view;
+    uint32_t indices_view;
+    uint32_t texcoords_view;
+    uint32_t normals_view;
+    uint32_t grid_dims[2];
+};
+
+struct CRTSMesh {
+    uint32_t first_geometry;
+    uint32_t num_geometries;
+};
+
+// The parameterized mesh's material IDs, one per-geometry of the mesh, start at
+// first_material_id in the material ID table
+struct CRTSParameterizedMesh {
+    uint32_t mesh;
+    uint32_t first_material_id;
+};
+
+// An instance of a parameterized mesh, or a group instance of an instance group, placed by
+// the column-major transform
+struct CRTSInstance {
+    float transform[16];
+    uint32_t id;
+    uint32_t pad[3];
+};
+
+struct CRTSInstanceGroup {
+    uint32_t first_instance;
+    uint32_t num_instances;
+    uint32_t first_group_instance;
+    uint32_t num_group_instances;
+};
+
+struct CRTSImage {
+    uint32_t view;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    // The ColorSpace of the image
+    uint32_t color_space;
+    uint32_t name_offset;
+    uint32_t name_size;
+    uint32_t pad;
+};
+
+struct Scene;
+
+struct CRTSWriteOptions {
+    uint32_t compression = CRTS_COMPRESSION_NONE;
+    // The LZ4 acceleration or zstd compression level, 0 for the library's default
+    int compression_level = 0;
+};
+
+// Check if the compression method is supported by this build
+bool crts_compression_supported(const uint32_t compression);
+
+/* Decompress the buffer into out, which must be uncompressed_size bytes. Throws a
+ * std::runtime_error if the data is invalid or the compression method isn't supported
+ */
+void crts_decompress(const uint32_t compression,
+                     const uint8_t *data,
+                     const uint64_t size,
+                     uint8_t *out,
+                     const uint64_t uncompressed_size);
+
+/* Write the scene to a CRTS v2 file, compressing the buffer views in parallel. Views which
+ * don't get smaller when compressed are stored uncompressed. Textures are stored as
+ * pre-decoded RGBA8. Throws a std::runtime_error if the file can't be written
+ */
+void write_crts(const Scene &scene, const std::string &file, const CRTSWriteOptions &options);
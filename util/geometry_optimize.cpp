@@ -0,0 +1,234 @@
+#include "geometry_optimize.h"
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "util.h"
+
+// Run f(begin, end) over blocks of [0, n), in parallel if requested
+template <typename F>
+static void for_each_block(const size_t n, const bool parallel, const F &f)
+{
+    const size_t block_size = 64 * 1024;
+    const size_t num_blocks = (n + block_size - 1) / block_size;
+    if (!parallel || num_blocks < 2) {
+        f(size_t(0), n);
+        return;
+    }
+    parallel_for(0, num_blocks, [&](const size_t b) {
+        f(b * block_size, std::min(n, (b + 1) * block_size));
+    });
+}
+
+template <typename It, typename Compare>
+static void sort_elements(It begin, It end, const bool parallel, const Compare &comp)
+{
+    if (parallel) {
+        parallel_sort(begin, end, comp);
+    } else {
+        std::sort(begin, end, comp);
+    }
+}
+
+// Check the geometry's attributes are per-vertex and its indices are in bounds
+static bool valid_geometry(const Geometry &geom)
+{
+    const size_t n = geom.vertices.size();
+    if ((!geom.normals.empty() && geom.normals.size() != n) ||
+        (!geom.uvs.empty() && geom.uvs.size() != n)) {
+        return false;
+    }
+    for (const auto &tri : geom.indices) {
+        if (tri.x >= n || tri.y >= n || tri.z >= n) {
+            throw std::runtime_error("Geometry has out of bounds vertex indices");
+        }
+    }
+    return true;
+}
+
+template <typename T>
+static int compare_attribute(const AttributeBuffer<T> &attrib,
+                             const uint32_t a,
+                             const uint32_t b)
+{
+    return attrib.empty() ? 0 : std::memcmp(&attrib[a], &attrib[b], sizeof(T));
+}
+
+// Check if the order keeps all n elements in place
+static bool is_identity_order(const std::vector<uint32_t> &order, const size_t n)
+{
+    if (order.size() != n) {
+        return false;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (order[i] != i) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/* Gather the vertex attributes into new owned buffers following the vertex order. Vertices
+ * already in order keep their buffers, which may be shared with other geometries or
+ * reference a memory mapped file
+ */
+static void gather_vertices(Geometry &geom,
+                            const std::vector<uint32_t> &order,
+                            const bool parallel)
+{
+    if (is_identity_order(order, geom.vertices.size())) {
+        return;
+    }
+    std::vector<glm::vec3> vertices(order.size());
+    std::vector<glm::vec3> normals(geom.normals.empty() ? 0 : order.size());
+    std::vector<glm::vec2> uvs(geom.uvs.empty() ? 0 : order.size());
+    for_each_block(order.size(), parallel, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            vertices[i] = geom.vertices[order[i]];
+            if (!normals.empty()) {
+                normals[i] = geom.normals[order[i]];
+            }
+            if (!uvs.empty()) {
+                uvs[i] = geom.uvs[order[i]];
+            }
+        }
+    });
+    geom.vertices = std::move(vertices);
+    geom.normals = std::move(normals);
+    geom.uvs = std::move(uvs);
+}
+
+size_t weld_vertices(Geometry &geom, const bool parallel)
+{
+    const size_t n = geom.vertices.size();
+    if (n == 0 || !valid_geometry(geom)) {
+        return 0;
+    }
+
+    // Sort the vertices by their attributes to bring identical vertices together, ordering
+    // identical vertices by index so the first of each run is the earliest copy
+    std::vector<uint32_t> sorted(n);
+    std::iota(sorted.begin(), sorted.end(), 0);
+    auto vertex_less = [&](const uint32_t a, const uint32_t b) {
+        int c = compare_attribute(geom.vertices, a, b);
+        if (c == 0) {
+            c = compare_attribute(geom.normals, a, b);
+        }
+        if (c == 0) {
+            c = compare_attribute(geom.uvs, a, b);
+        }
+        return c != 0 ? c < 0 : a < b;
+    };
+    sort_elements(sorted.begin(), sorted.end(), parallel, vertex_less);
+
+    std::vector<uint32_t> first_copy(n);
+    first_copy[sorted[0]] = sorted[0];
+    for (size_t i = 1; i < n; ++i) {
+        const uint32_t a = sorted[i - 1];
+        const uint32_t b = sorted[i];
+        const bool same = compare_attribute(geom.vertices, a, b) == 0 &&
+                          compare_attribute(geom.normals, a, b) == 0 &&
+                          compare_attribute(geom.uvs, a, b) == 0;
+        first_copy[b] = same ? first_copy[a] : b;
+    }
+
+    // Number the unique vertices in their original order
+    std::vector<uint32_t> remap(n);
+    std::vector<uint32_t> unique_vertices;
+    for (uint32_t i = 0; i < n; ++i) {
+        if (first_copy[i] == i) {
+            remap[i] = unique_vertices.size();
+            unique_vertices.push_back(i);
+        } else {
+            remap[i] = remap[first_copy[i]];
+        }
+    }
+    if (unique_vertices.size() == n) {
+        return 0;
+    }
+
+    glm::uvec3 *indices = geom.indices.mutable_data();
+    for_each_block(geom.indices.size(), parallel, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            indices[i] =
+                glm::uvec3(remap[indices[i].x], remap[indices[i].y], remap[indices[i].z]);
+        }
+    });
+    gather_vertices(geom, unique_vertices, parallel);
+    return n - unique_vertices.size();
+}
+
+size_t morton_reorder(Geometry &geom, const bool parallel)
+{
+    const size_t num_tris = geom.indices.size();
+    if (num_tris == 0 || !valid_geometry(geom)) {
+        return 0;
+    }
+
+    glm::vec3 bounds_min(std::numeric_limits<float>::infinity());
+    glm::vec3 bounds_max(-std::numeric_limits<float>::infinity());
+    for (const auto &v : geom.vertices) {
+        bounds_min = glm::min(bounds_min, v);
+        bounds_max = glm::max(bounds_max, v);
+    }
+    const glm::vec3 extent = glm::max(bounds_max - bounds_min, glm::vec3(1e-6f));
+
+    std::vector<std::pair<uint32_t, uint32_t>> tri_order(num_tris);
+    for_each_block(num_tris, parallel, [&](const size_t begin, const size_t end) {
+        for (size_t i = begin; i < end; ++i) {
+            const glm::uvec3 &tri = geom.indices[i];
+            const glm::vec3 centroid =
+                (geom.vertices[tri.x] + geom.vertices[tri.y] + geom.vertices[tri.z]) / 3.f;
+            const glm::vec3 p =
+                glm::clamp(1023.f * (centroid - bounds_min) / extent, 0.f, 1023.f);
+            tri_order[i] = std::make_pair(morton_code3(glm::uvec3(p)), uint32_t(i));
+        }
+    });
+    sort_elements(tri_order.begin(),
+                  tri_order.end(),
+                  parallel,
+                  std::less<std::pair<uint32_t, uint32_t>>());
+
+    // Number the vertices in the order the sorted triangles first reference them
+    const uint32_t unused = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> remap(geom.vertices.size(), unused);
+    std::vector<uint32_t> vertex_order;
+    vertex_order.reserve(geom.vertices.size());
+    std::vector<glm::uvec3> indices(num_tris);
+    for (size_t i = 0; i < num_tris; ++i) {
+        const glm::uvec3 &tri = geom.indices[tri_order[i].second];
+        for (int j = 0; j < 3; ++j) {
+            if (remap[tri[j]] == unused) {
+                remap[tri[j]] = vertex_order.size();
+                vertex_order.push_back(tri[j]);
+            }
+            indices[i][j] = remap[tri[j]];
+        }
+    }
+    // Keep the index buffer of geometries which are already in Morton order
+    bool reordered = !is_identity_order(vertex_order, geom.vertices.size());
+    for (size_t i = 0; i < num_tris && !reordered; ++i) {
+        reordered = tri_order[i].second != i;
+    }
+    if (reordered) {
+        geom.indices = std::move(indices);
+    }
+    const size_t unused_vertices = geom.vertices.size() - vertex_order.size();
+    gather_vertices(geom, vertex_order, parallel);
+    return unused_vertices;
+}
+
+GeometryOptimizeStats optimize_geometry(Geometry &geom, const bool parallel)
+{
+    GeometryOptimizeStats stats;
+    if (geom.is_grid()) {
+        return stats;
+    }
+    stats.welded_vertices = weld_vertices(geom, parallel);
+    stats.unused_vertices = morton_reorder(geom, parallel);
+    return stats;
+}
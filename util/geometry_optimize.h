@@ -0,0 +1,44 @@
+#pragma once
+
+#include "mesh.h"
+
+/* Geometry optimizations which can be applied to any loaded geometry. Loaders produce
+ * geometry in file order, with duplicated vertices wherever the file splits them, and
+ * triangles in an arbitrary order. These passes weld the duplicates and lay the triangles
+ * and vertices out along a Morton curve, so that spatially nearby triangles and their
+ * vertices are nearby in memory. This improves the locality of BVH builds and makes the
+ * shading attribute fetches after a hit more cache friendly.
+ *
+ * The passes replace the buffers they change with new owned ones, so the optimized
+ * buffers are no longer shared with other geometries or memory mapped from a file.
+ * Geometries which are already optimized keep their buffers.
+ *
+ * If parallel is set the sorts and per-element work of a pass run on all hardware threads,
+ * which is best for large geometries. Many small geometries are better optimized in
+ * parallel with each other, with parallel unset.
+ */
+
+/* Weld the vertices with bitwise identical positions, normals and uvs, and remap the
+ * indices to the welded vertices. The vertices keep their relative order. Returns the number
+ * of vertices removed
+ */
+size_t weld_vertices(Geometry &geom, const bool parallel);
+
+/* Sort the triangles along a Morton curve through their centroids, then renumber the
+ * vertices in the order the sorted triangles first use them. Vertices not used by any
+ * triangle are removed, returns the number of vertices removed
+ */
+size_t morton_reorder(Geometry &geom, const bool parallel);
+
+// The number of vertices removed from a geometry by each optimization
+struct GeometryOptimizeStats {
+    // Duplicates merged with an identical vertex
+    size_t welded_vertices = 0;
+    // Vertices not used by any triangle
+    size_t unused_vertices = 0;
+};
+
+/* Weld and Morton reorder the geometry. Grid geometries are left unchanged, since their
+ * vertex order encodes the grid
+ */
+GeometryOptimizeStats optimize_geometry(Geometry &geom, const bool parallel);
@@ -0,0 +1,180 @@
+#include "gltf_meshopt.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include "json.hpp"
+#include "util.h"
+
+#ifdef MESHOPT_ENABLED
+#include <meshoptimizer.h>
+#endif
+
+static const std::string MESHOPT_EXTENSION = "EXT_meshopt_compression";
+
+// The GLB header, followed by the length and type of the JSON chunk
+static const size_t GLB_JSON_OFFSET = 20;
+
+GLTFMeshoptFile read_gltf_meshopt(const uint8_t *file, const size_t size, const bool binary)
+{
+    using json = nlohmann::json;
+
+    const uint8_t *json_data = file;
+    size_t json_size = size;
+    if (binary) {
+        uint32_t chunk_length = 0;
+        if (size >= GLB_JSON_OFFSET) {
+            std::memcpy(&chunk_length, file + 12, sizeof(uint32_t));
+        }
+        if (size < GLB_JSON_OFFSET || chunk_length > size - GLB_JSON_OFFSET) {
+            throw std::runtime_error("Invalid GLB file header");
+        }
+        json_data = file + GLB_JSON_OFFSET;
+        json_size = chunk_length;
+    }
+
+    GLTFMeshoptFile meshopt;
+    if (std::search(json_data,
+                    json_data + json_size,
+                    MESHOPT_EXTENSION.begin(),
+                    MESHOPT_EXTENSION.end()) == json_data + json_size) {
+        return meshopt;
+    }
+
+    json doc = json::parse(json_data, json_data + json_size);
+    auto buffer_views = doc.find("bufferViews");
+    if (buffer_views != doc.end()) {
+        for (size_t i = 0; i < buffer_views->size(); ++i) {
+            const json &v = (*buffer_views)[i];
+            auto extensions = v.find("extensions");
+            if (extensions == v.end() || !extensions->count(MESHOPT_EXTENSION)) {
+                continue;
+            }
+            const json &ext = (*extensions)[MESHOPT_EXTENSION];
+            GLTFMeshoptView view;
+            view.buffer_view = i;
+            view.buffer = ext.at("buffer").get<size_t>();
+            view.byte_offset = ext.value("byteOffset", size_t(0));
+            view.byte_length = ext.at("byteLength").get<size_t>();
+            view.byte_stride = ext.at("byteStride").get<size_t>();
+            view.count = ext.at("count").get<size_t>();
+            view.mode = ext.at("mode").get<std::string>();
+            view.filter = ext.value("filter", std::string("NONE"));
+            meshopt.views.push_back(view);
+        }
+    }
+
+    // Fallback buffers without data get a small placeholder so TinyGLTF will load them. The
+    // views in them are redirected to the decoded data after loading. In GLB files a buffer
+    // without a uri is the BIN chunk, which is only allowed for the first buffer
+    bool patched = false;
+    auto buffers = doc.find("buffers");
+    if (buffers != doc.end()) {
+        for (size_t i = binary ? 1 : 0; i < buffers->size(); ++i) {
+            json &b = (*buffers)[i];
+            auto extensions = b.find("extensions");
+            if (b.count("uri") || extensions == b.end() ||
+                !extensions->count(MESHOPT_EXTENSION)) {
+                continue;
+            }
+            b["uri"] = "data:application/octet-stream;base64,AAAA";
+            b["byteLength"] = 3;
+            patched = true;
+        }
+    }
+    if (!patched) {
+        return meshopt;
+    }
+
+    std::string patched_json = doc.dump();
+    if (!binary) {
+        meshopt.patched_file.assign(patched_json.begin(), patched_json.end());
+        return meshopt;
+    }
+
+    // Rebuild the GLB file with the patched JSON chunk, padded to 4 bytes with spaces as
+    // required by the spec, followed by the original BIN chunk
+    patched_json.resize((patched_json.size() + 3) / 4 * 4, ' ');
+    const uint8_t *bin_chunk = json_data + json_size;
+    const size_t bin_size = file + size - bin_chunk;
+    const uint32_t glb_size = GLB_JSON_OFFSET + patched_json.size() + bin_size;
+    const uint32_t json_chunk_size = patched_json.size();
+    meshopt.patched_file.resize(glb_size);
+    uint8_t *out = meshopt.patched_file.data();
+    std::memcpy(out, file, 8);
+    std::memcpy(out + 8, &glb_size, sizeof(uint32_t));
+    std::memcpy(out + 12, &json_chunk_size, sizeof(uint32_t));
+    std::memcpy(out + 16, file + 16, sizeof(uint32_t));
+    std::memcpy(out + GLB_JSON_OFFSET, patched_json.data(), patched_json.size());
+    std::memcpy(out + GLB_JSON_OFFSET + patched_json.size(), bin_chunk, bin_size);
+    return meshopt;
+}
+
+void decode_gltf_meshopt(const std::vector<GLTFMeshoptView> &views, tinygltf::Model &model)
+{
+    if (views.empty()) {
+        return;
+    }
+#ifndef MESHOPT_ENABLED
+    // Without meshoptimizer the views' fallback data is used, if the file provides it
+    auto fnd = std::find(
+        model.extensionsRequired.begin(), model.extensionsRequired.end(), MESHOPT_EXTENSION);
+    if (fnd != model.extensionsRequired.end()) {
+        throw std::runtime_error(
+            "Loading glTF files with EXT_meshopt_compression requires meshoptimizer");
+    }
+#else
+    std::vector<std::vector<uint8_t>> decoded(views.size());
+    parallel_for(0, views.size(), [&](const size_t i) {
+        const GLTFMeshoptView &v = views[i];
+        if (v.buffer >= model.buffers.size() ||
+            v.byte_offset > model.buffers[v.buffer].data.size() ||
+            v.byte_length > model.buffers[v.buffer].data.size() - v.byte_offset) {
+            throw std::runtime_error("EXT_meshopt_compression data is out of bounds");
+        }
+        if (v.byte_stride == 0 || v.count > size_t(-1) / v.byte_stride) {
+            throw std::runtime_error("Invalid EXT_meshopt_compression buffer view size");
+        }
+        const uint8_t *src = model.buffers[v.buffer].data.data() + v.byte_offset;
+        decoded[i].resize(v.count * v.byte_stride);
+        uint8_t *dst = decoded[i].data();
+
+        int err = 0;
+        if (v.mode == "ATTRIBUTES") {
+            err = meshopt_decodeVertexBuffer(dst, v.count, v.byte_stride, src, v.byte_length);
+        } else if (v.mode == "TRIANGLES") {
+            err = meshopt_decodeIndexBuffer(dst, v.count, v.byte_stride, src, v.byte_length);
+        } else if (v.mode == "INDICES") {
+            err = meshopt_decodeIndexSequence(dst, v.count, v.byte_stride, src, v.byte_length);
+        } else {
+            throw std::runtime_error("Unsupported EXT_meshopt_compression mode " + v.mode);
+        }
+        if (err != 0) {
+            throw std::runtime_error("Failed to decode EXT_meshopt_compression buffer view " +
+                                     std::to_string(v.buffer_view));
+        }
+
+        if (v.filter == "OCTAHEDRAL") {
+            meshopt_decodeFilterOct(dst, v.count, v.byte_stride);
+        } else if (v.filter == "QUATERNION") {
+            meshopt_decodeFilterQuat(dst, v.count, v.byte_stride);
+        } else if (v.filter == "EXPONENTIAL") {
+            meshopt_decodeFilterExp(dst, v.count, v.byte_stride);
+        } else if (v.filter != "NONE") {
+            throw std::runtime_error("Unsupported EXT_meshopt_compression filter " +
+                                     v.filter);
+        }
+    });
+
+    // Each decoded view gets its own buffer
+    for (size_t i = 0; i < views.size(); ++i) {
+        tinygltf::BufferView &view = model.bufferViews.at(views[i].buffer_view);
+        view.buffer = model.buffers.size();
+        view.byteOffset = 0;
+        view.byteLength = decoded[i].size();
+
+        tinygltf::Buffer buffer;
+        buffer.data = std::move(decoded[i]);
+        model.buffers.push_back(std::move(buffer));
+    }
+#endif
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "tiny_gltf.h"
+
+/* Support for EXT_meshopt_compression, which TinyGLTF doesn't handle: it drops the buffer
+ * view extensions and fails to load the fallback buffers the compressed views point to,
+ * which have no data. The extension is read from the glTF JSON before loading the file with
+ * TinyGLTF, and the compressed buffer views are then decoded with meshoptimizer into new
+ * buffers, which the views are redirected to. The decoded views are regular glTF buffer
+ * views, read through the BufferView/Accessor utilities like any other.
+ */
+
+// An EXT_meshopt_compression buffer view
+struct GLTFMeshoptView {
+    size_t buffer_view = 0;
+    // The compressed data
+    size_t buffer = 0;
+    size_t byte_offset = 0;
+    size_t byte_length = 0;
+    // The decoded elements
+    size_t byte_stride = 0;
+    size_t count = 0;
+    std::string mode;
+    std::string filter = "NONE";
+};
+
+struct GLTFMeshoptFile {
+    std::vector<GLTFMeshoptView> views;
+    // The file rewritten with placeholder data for its fallback buffers, if it has fallback
+    // buffers without data. Otherwise empty and the file can be loaded as is
+    std::vector<uint8_t> patched_file;
+};
+
+/* Read the EXT_meshopt_compression buffer views of the glTF or GLB file. Files which don't
+ * use the extension are only scanned for its name, and not parsed
+ */
+GLTFMeshoptFile read_gltf_meshopt(const uint8_t *file, const size_t size, const bool binary);
+
+/* Decode the compressed buffer views in parallel and redirect the model's buffer views to
+ * the decoded data. Throws a std::runtime_error if decoding fails, or if meshoptimizer
+ * support wasn't built and the views have no fallback data
+ */
+void decode_gltf_meshopt(const std::vector<GLTFMeshoptView> &views, tinygltf::Model &model);
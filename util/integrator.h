@@ -0,0 +1,23 @@
+// This header is shared across all backends
+
+#ifndef UTIL_INTEGRATOR_H
+#define UTIL_INTEGRATOR_H
+
+/* The integrators which can be selected at runtime. The path tracer is the reference
+ * integrator, the others are cheap previews for interactively navigating large scenes:
+ *
+ * ALBEDO: the base color of the material at the primary hit
+ * NORMAL: the world space shading normal at the primary hit mapped to [0, 1]
+ * AMBIENT_OCCLUSION: the unoccluded fraction of cosine-weighted rays from the primary hit
+ * DIRECT_LIGHTING: light sampling at the primary hit only, without indirect bounces
+ */
+
+#define INTEGRATOR_PATH_TRACER 0
+#define INTEGRATOR_ALBEDO 1
+#define INTEGRATOR_NORMAL 2
+#define INTEGRATOR_AMBIENT_OCCLUSION 3
+#define INTEGRATOR_DIRECT_LIGHTING 4
+#define INTEGRATOR_COUNT 5
+
+#endif
+
@@ -1,19 +1,50 @@
 #include "material.h"
+#include <algorithm>
 #include <stdexcept>
 #include "stb_image.h"
+#include "util.h"
 
-Image::Image(const std::string &file, const std::string &name, ColorSpace color_space)
-    : name(name), color_space(color_space)
+// Flip the image rows in place. This is done instead of setting
+// stbi_set_flip_vertically_on_load, which is global state shared by all loading threads
+static void flip_rows(uint8_t *data, const int width, const int height, const int channels)
+{
+    const size_t row_bytes = size_t(width) * channels;
+    for (int y = 0; y < height / 2; ++y) {
+        std::swap_ranges(data + y * row_bytes,
+                         data + (y + 1) * row_bytes,
+                         data + (height - y - 1) * row_bytes);
+    }
+}
+
+// Decode the job's image as RGBA8, throwing if it fails to load
+static void decode_image(const ImageDecodeJob &job, Image &image)
 {
-    stbi_set_flip_vertically_on_load(1);
-    uint8_t *data = stbi_load(file.c_str(), &width, &height, &channels, 4);
-    channels = 4;
+    int x, y, n;
+    uint8_t *data = nullptr;
+    if (job.encoded) {
+        data = stbi_load_from_memory(job.encoded, job.encoded_size, &x, &y, &n, 4);
+    } else {
+        data = stbi_load(job.file.c_str(), &x, &y, &n, 4);
+    }
     if (!data) {
-        throw std::runtime_error("Failed to load " + file);
+        throw std::runtime_error("Failed to load " + (job.encoded ? image.name : job.file));
+    }
+    if (job.flip_y) {
+        flip_rows(data, x, y, 4);
     }
-    img = std::vector<uint8_t>(data, data + width * height * channels);
+    image.width = x;
+    image.height = y;
+    image.channels = 4;
+    image.img = std::vector<uint8_t>(data, data + size_t(x) * y * 4);
     stbi_image_free(data);
-    stbi_set_flip_vertically_on_load(0);
+}
+
+Image::Image(const std::string &file, const std::string &name, ColorSpace color_space)
+    : name(name), color_space(color_space)
+{
+    ImageDecodeJob job;
+    job.file = file;
+    decode_image(job, *this);
 }
 
 Image::Image(const uint8_t *buf,
@@ -31,3 +62,29 @@ Image::Image(const uint8_t *buf,
 {
 }
 
+void decode_images(const std::vector<ImageDecodeJob> &jobs, std::vector<Image> &images)
+{
+    parallel_for(0, jobs.size(), [&](const size_t i) {
+        decode_image(jobs[i], images[jobs[i].image_id]);
+    });
+}
+
+std::vector<size_t> try_decode_images(const std::vector<ImageDecodeJob> &jobs,
+                                      std::vector<Image> &images)
+{
+    std::vector<uint8_t> failed(jobs.size(), 0);
+    parallel_for(0, jobs.size(), [&](const size_t i) {
+        try {
+            decode_image(jobs[i], images[jobs[i].image_id]);
+        } catch (const std::runtime_error &) {
+            failed[i] = 1;
+        }
+    });
+    std::vector<size_t> failed_ids;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        if (failed[i]) {
+            failed_ids.push_back(jobs[i].image_id);
+        }
+    }
+    return failed_ids;
+}
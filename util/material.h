@@ -26,6 +26,32 @@ struct Image {
     Image() = default;
 };
 
+/* An image whose decoding is deferred until the scene has been parsed, so that all the
+ * scene's textures can be decoded in parallel by decode_images. The image is decoded from
+ * the encoded bytes if they're set, otherwise it's read from the file. The encoded bytes
+ * must stay valid until the images are decoded
+ */
+struct ImageDecodeJob {
+    size_t image_id = 0;
+    std::string file;
+    const uint8_t *encoded = nullptr;
+    size_t encoded_size = 0;
+    // Flip the image vertically to the orientation used by OBJ, PBRT and CRTS texcoords
+    bool flip_y = true;
+};
+
+/* Decode the jobs' images to RGBA8 into the images they refer to, in parallel. The images'
+ * names and color spaces are left unchanged. Throws a std::runtime_error if any image
+ * fails to load
+ */
+void decode_images(const std::vector<ImageDecodeJob> &jobs, std::vector<Image> &images);
+
+/* Decode the jobs' images like decode_images, but skip the images which fail to load
+ * instead of throwing. Returns the ids of the images which failed, which are left unchanged
+ */
+std::vector<size_t> try_decode_images(const std::vector<ImageDecodeJob> &jobs,
+                                      std::vector<Image> &images);
+
 struct DisneyMaterial {
     glm::vec3 base_color = glm::vec3(0.9f);
     float metallic = 0;
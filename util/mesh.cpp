@@ -1,5 +1,6 @@
 #include "mesh.h"
 #include <algorithm>
+#include <array>
 #include <numeric>
 
 size_t Geometry::num_tris() const
@@ -7,6 +8,93 @@ size_t Geometry::num_tris() const
     return indices.size();
 }
 
+bool Geometry::is_grid() const
+{
+    return grid_dims.x != 0 && grid_dims.y != 0;
+}
+
+bool Geometry::detect_grid()
+{
+    if (indices.size() < 2 || vertices.size() < 4) {
+        return false;
+    }
+
+    // The first cell's triangles reference the corners {0, 1, width, width + 1}, which gives
+    // us the width of the grid to check the rest of the triangles against
+    uint32_t max_corner = 0;
+    for (size_t t = 0; t < 2; ++t) {
+        for (size_t i = 0; i < 3; ++i) {
+            max_corner = std::max(max_corner, indices[t][i]);
+        }
+    }
+    if (max_corner < 3) {
+        return false;
+    }
+    const uint32_t width = max_corner - 1;
+    if (vertices.size() % width != 0) {
+        return false;
+    }
+    const uint32_t height = vertices.size() / width;
+    if (height < 2 || indices.size() != 2 * size_t(width - 1) * (height - 1)) {
+        return false;
+    }
+
+    // Grid space positions of the cell corners, in counter-clockwise order
+    const std::array<glm::ivec2, 4> corner_pos = {
+        glm::ivec2(0, 0), glm::ivec2(1, 0), glm::ivec2(1, 1), glm::ivec2(0, 1)};
+    for (size_t cell = 0; cell < indices.size() / 2; ++cell) {
+        const uint32_t v = (cell / (width - 1)) * width + cell % (width - 1);
+        const std::array<uint32_t, 4> corners = {v, v + 1, v + width + 1, v + width};
+
+        int missing[2] = {-1, -1};
+        for (size_t t = 0; t < 2; ++t) {
+            const glm::uvec3 &tri = indices[2 * cell + t];
+            uint32_t found = 0;
+            glm::ivec2 p[3];
+            for (size_t i = 0; i < 3; ++i) {
+                auto fnd = std::find(corners.begin(), corners.end(), tri[i]);
+                if (fnd == corners.end()) {
+                    return false;
+                }
+                found |= 1 << std::distance(corners.begin(), fnd);
+                p[i] = corner_pos[std::distance(corners.begin(), fnd)];
+            }
+            for (int c = 0; c < 4; ++c) {
+                if (found == (0xf & ~(1u << c))) {
+                    missing[t] = c;
+                }
+            }
+            const glm::ivec2 e0 = p[1] - p[0];
+            const glm::ivec2 e1 = p[2] - p[0];
+            if (missing[t] == -1 || e0.x * e1.y - e0.y * e1.x <= 0) {
+                return false;
+            }
+        }
+        // The two triangles must split the cell along the v + 1 to v + width diagonal, which
+        // is how Embree's grid geometry triangulates its cells. A cell split along the other
+        // diagonal is a different surface if the cell isn't planar
+        if (missing[0] != 2 || missing[1] != 0) {
+            return false;
+        }
+    }
+    grid_dims = glm::uvec2(width, height);
+    return true;
+}
+
+std::vector<glm::uvec3> make_grid_indices(const glm::uvec2 &grid_dims)
+{
+    std::vector<glm::uvec3> indices;
+    indices.reserve(2 * size_t(grid_dims.x - 1) * (grid_dims.y - 1));
+    for (uint32_t y = 0; y < grid_dims.y - 1; ++y) {
+        for (uint32_t x = 0; x < grid_dims.x - 1; ++x) {
+            const uint32_t v = y * grid_dims.x + x;
+            indices.emplace_back(v, v + 1, v + grid_dims.x);
+            indices.emplace_back(v + grid_dims.x + 1, v + grid_dims.x, v + 1);
+        }
+    }
+    return indices;
+}
+
 Mesh::Mesh(const std::vector<Geometry> &geometries) : geometries(geometries) {}
 
 size_t Mesh::num_tris() const
@@ -26,3 +114,8 @@ Instance::Instance(const glm::mat4 &transform, size_t parameterized_mesh_id)
     : transform(transform), parameterized_mesh_id(parameterized_mesh_id)
 {
 }
+
+GroupInstance::GroupInstance(const glm::mat4 &transform, size_t group_id)
+    : transform(transform), group_id(group_id)
+{
+}
@@ -1,16 +1,35 @@
 #pragma once
 
 #include <vector>
+#include "attribute_buffer.h"
 #include <glm/glm.hpp>
 
 struct Geometry {
-    std::vector<glm::vec3> vertices, normals;
-    std::vector<glm::vec2> uvs;
-    std::vector<glm::uvec3> indices;
+    // The attributes can reference external buffers, e.g., views into a memory mapped CRTS
+    // file, which backends can then use in place
+    AttributeBuffer<glm::vec3> vertices, normals;
+    AttributeBuffer<glm::vec2> uvs;
+    AttributeBuffer<glm::uvec3> indices;
+
+    // If the vertices form a regular grid (e.g., a height field) they are stored row-major
+    // with grid_dims.x vertices per-row. The triangle indices are still kept for backends
+    // which don't support grid geometry. A grid_dims of 0 means this is not a grid.
+    glm::uvec2 grid_dims = glm::uvec2(0);
 
     size_t num_tris() const;
+
+    bool is_grid() const;
+
+    /* Check if the triangles tessellate a regular grid of the vertices, two counter-clockwise
+     * triangles per-cell in row-major cell order split along the same diagonal as
+     * make_grid_indices, and set grid_dims if they do.
+     */
+    bool detect_grid();
 };
 
+// Build the triangle indices for a row-major grid of vertices with the given dimensions
+std::vector<glm::uvec3> make_grid_indices(const glm::uvec2 &grid_dims);
+
 struct Mesh {
     std::vector<Geometry> geometries;
 
@@ -45,3 +64,25 @@ struct Instance {
 
     Instance() = default;
 };
+
+/* A group instance places an instance group at some location in the scene, or within its
+ * parent instance group
+ */
+struct GroupInstance {
+    glm::mat4 transform;
+    size_t group_id;
+
+    GroupInstance(const glm::mat4 &transform, size_t group_id);
+
+    GroupInstance() = default;
+};
+
+/* An instance group is a collection of instances of parameterized meshes and other instance
+ * groups, placed in the group's coordinate space. Groups let hierarchically instanced scenes
+ * (e.g., forests of trees made of instanced branches and leaves) be represented without
+ * expanding them into a single level of instances.
+ */
+struct InstanceGroup {
+    std::vector<Instance> instances;
+    std::vector<GroupInstance> group_instances;
+};
@@ -0,0 +1,436 @@
+#include "obj_parser.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <numeric>
+#include <stdexcept>
+#include "file_mapping.h"
+#include "util.h"
+
+// Face indices whose components were relative (negative) and are offset by the number of
+// attributes in the previous chunks once the chunks are merged
+static const uint8_t RELATIVE_VERTEX = 1;
+static const uint8_t RELATIVE_NORMAL = 2;
+static const uint8_t RELATIVE_TEXCOORD = 4;
+
+// A new shape or material starting at a triangle in the chunk
+struct ChunkEvent {
+    size_t triangle;
+    bool new_shape;
+    std::string name;
+};
+
+/* The attributes and triangles parsed from a chunk of the file. Absolute face indices are
+ * stored zero based, relative ones are stored relative to the start of the chunk's
+ * attributes and flagged in relative
+ */
+struct ObjChunk {
+    std::vector<float> vertices;
+    std::vector<float> normals;
+    std::vector<float> texcoords;
+    std::vector<tinyobj::index_t> indices;
+    std::vector<uint8_t> relative;
+    std::vector<ChunkEvent> events;
+    std::vector<std::string> mtllibs;
+    size_t unsupported_faces = 0;
+    // Triangles with indices out of range of the merged attributes, which are dropped
+    std::vector<bool> invalid_triangles;
+    size_t num_invalid_triangles = 0;
+};
+
+static bool is_space(const char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+static void skip_space(const char *&p, const char *end)
+{
+    while (p != end && is_space(*p)) {
+        ++p;
+    }
+}
+
+// Read the rest of the line as a name, without the trailing whitespace
+static std::string read_name(const char *&p, const char *end)
+{
+    skip_space(p, end);
+    const char *start = p;
+    while (p != end && *p != '\n') {
+        ++p;
+    }
+    const char *name_end = p;
+    while (name_end != start && is_space(*(name_end - 1))) {
+        --name_end;
+    }
+    return std::string(start, name_end);
+}
+
+static bool parse_int(const char *&p, const char *end, int &x)
+{
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    if (p == end || *p < '0' || *p > '9') {
+        return false;
+    }
+    int64_t v = 0;
+    while (p != end && *p >= '0' && *p <= '9') {
+        v = v * 10 + (*p - '0');
+        ++p;
+    }
+    x = negative ? -v : v;
+    return true;
+}
+
+// Parse a float without reading past the end of the chunk, which strtof can't guarantee
+// on the unterminated file mapping
+static bool parse_float(const char *&p, const char *end, float &x)
+{
+    skip_space(p, end);
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    double mantissa = 0;
+    int exponent = 0;
+    bool digits = false;
+    while (p != end && *p >= '0' && *p <= '9') {
+        mantissa = mantissa * 10 + (*p - '0');
+        digits = true;
+        ++p;
+    }
+    if (p != end && *p == '.') {
+        ++p;
+        while (p != end && *p >= '0' && *p <= '9') {
+            mantissa = mantissa * 10 + (*p - '0');
+            --exponent;
+            digits = true;
+            ++p;
+        }
+    }
+    if (!digits) {
+        return false;
+    }
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        int e = 0;
+        if (!parse_int(p, end, e)) {
+            return false;
+        }
+        exponent += e;
+    }
+    x = static_cast<float>((negative ? -mantissa : mantissa) * std::pow(10.0, exponent));
+    return true;
+}
+
+// Parse a v, v/t, v//n or v/t/n face vertex, with missing components set to -1
+static bool parse_face_vertex(const char *&p,
+                              const char *end,
+                              const ObjChunk &chunk,
+                              tinyobj::index_t &index,
+                              uint8_t &relative)
+{
+    index.vertex_index = -1;
+    index.normal_index = -1;
+    index.texcoord_index = -1;
+    relative = 0;
+
+    // Absolute indices are one based, relative ones count back from the attributes
+    // parsed so far in the chunk
+    auto resolve = [&](int i, int &out, const size_t chunk_count, const uint8_t flag) {
+        if (i > 0) {
+            out = i - 1;
+        } else if (i < 0) {
+            out = int(chunk_count) + i;
+            relative |= flag;
+        } else {
+            return false;
+        }
+        return true;
+    };
+
+    int i = 0;
+    if (!parse_int(p, end, i) ||
+        !resolve(i, index.vertex_index, chunk.vertices.size() / 3, RELATIVE_VERTEX)) {
+        return false;
+    }
+    if (p == end || *p != '/') {
+        return true;
+    }
+    ++p;
+    if (p != end && *p != '/') {
+        const size_t num_texcoords = chunk.texcoords.size() / 2;
+        if (!parse_int(p, end, i) ||
+            !resolve(i, index.texcoord_index, num_texcoords, RELATIVE_TEXCOORD)) {
+            return false;
+        }
+    }
+    if (p == end || *p != '/') {
+        return true;
+    }
+    ++p;
+    return parse_int(p, end, i) &&
+           resolve(i, index.normal_index, chunk.normals.size() / 3, RELATIVE_NORMAL);
+}
+
+static void parse_chunk(const char *p, const char *end, ObjChunk &chunk)
+{
+    std::vector<tinyobj::index_t> face;
+    std::vector<uint8_t> face_relative;
+    while (p != end) {
+        skip_space(p, end);
+        const char *line_start = p;
+        while (p != end && *p != '\n' && !is_space(*p)) {
+            ++p;
+        }
+        const std::string keyword(line_start, p);
+
+        if (keyword == "v" || keyword == "vn") {
+            auto &attribs = keyword == "v" ? chunk.vertices : chunk.normals;
+            for (int i = 0; i < 3; ++i) {
+                float x = 0.f;
+                parse_float(p, end, x);
+                attribs.push_back(x);
+            }
+        } else if (keyword == "vt") {
+            for (int i = 0; i < 2; ++i) {
+                float x = 0.f;
+                parse_float(p, end, x);
+                chunk.texcoords.push_back(x);
+            }
+        } else if (keyword == "f") {
+            face.clear();
+            face_relative.clear();
+            while (true) {
+                skip_space(p, end);
+                if (p == end || *p == '\n') {
+                    break;
+                }
+                tinyobj::index_t index;
+                uint8_t relative = 0;
+                if (!parse_face_vertex(p, end, chunk, index, relative)) {
+                    break;
+                }
+                face.push_back(index);
+                face_relative.push_back(relative);
+            }
+            if (face.size() < 3) {
+                ++chunk.unsupported_faces;
+            }
+            // Triangulate polygons as a fan, which assumes they're convex, unlike the ear
+            // clipping in tinyobjloader
+            for (size_t i = 2; i < face.size(); ++i) {
+                for (const size_t v : {size_t(0), i - 1, i}) {
+                    chunk.indices.push_back(face[v]);
+                    chunk.relative.push_back(face_relative[v]);
+                }
+            }
+        } else if (keyword == "o" || keyword == "g") {
+            chunk.events.push_back(
+                ChunkEvent{chunk.indices.size() / 3, true, read_name(p, end)});
+        } else if (keyword == "usemtl") {
+            chunk.events.push_back(
+                ChunkEvent{chunk.indices.size() / 3, false, read_name(p, end)});
+        } else if (keyword == "mtllib") {
+            // A statement can reference multiple whitespace separated libraries
+            while (true) {
+                skip_space(p, end);
+                const char *start = p;
+                while (p != end && *p != '\n' && !is_space(*p)) {
+                    ++p;
+                }
+                if (p == start) {
+                    break;
+                }
+                chunk.mtllibs.push_back(std::string(start, p));
+            }
+        }
+
+        while (p != end && *p != '\n') {
+            ++p;
+        }
+        if (p != end) {
+            ++p;
+        }
+    }
+}
+
+void load_obj_parallel(const std::string &file,
+                       const std::string &mtl_base_dir,
+                       tinyobj::attrib_t &attrib,
+                       std::vector<tinyobj::shape_t> &shapes,
+                       std::vector<tinyobj::material_t> &materials,
+                       std::string &warn)
+{
+    const FileMapping mapping(file);
+    const char *data = reinterpret_cast<const char *>(mapping.data());
+    const size_t nbytes = mapping.nbytes();
+
+    // Split the file into chunks of at least a few MB, starting each chunk after the end of
+    // the line the split falls in
+    const size_t min_chunk_bytes = 4 * 1024 * 1024;
+    const size_t max_chunks = 8 * std::max(std::thread::hardware_concurrency(), 1u);
+    const size_t num_chunks =
+        std::max(size_t(1), std::min(max_chunks, nbytes / min_chunk_bytes));
+    std::vector<size_t> chunk_starts(num_chunks + 1, nbytes);
+    chunk_starts[0] = 0;
+    for (size_t i = 1; i < num_chunks; ++i) {
+        size_t start = std::max((i * nbytes) / num_chunks, chunk_starts[i - 1]);
+        while (start < nbytes && data[start - 1] != '\n') {
+            ++start;
+        }
+        chunk_starts[i] = start;
+    }
+
+    std::vector<ObjChunk> chunks(num_chunks);
+    parallel_for(0, num_chunks, [&](const size_t i) {
+        parse_chunk(data + chunk_starts[i], data + chunk_starts[i + 1], chunks[i]);
+    });
+
+    // Load the material libraries, in the order they're referenced
+    std::map<std::string, int> material_map;
+    for (const auto &c : chunks) {
+        for (const auto &lib : c.mtllibs) {
+            std::ifstream mtl_file(mtl_base_dir + "/" + lib);
+            if (!mtl_file) {
+                warn += "Failed to open material library " + lib + "\n";
+                continue;
+            }
+            std::string mtl_warn, mtl_err;
+            tinyobj::LoadMtl(&material_map, &materials, &mtl_file, &mtl_warn, &mtl_err);
+            warn += mtl_warn + mtl_err;
+        }
+    }
+
+    // Merge the attributes, offsetting the chunks' relative indices by the number of
+    // attributes in the preceding chunks
+    std::vector<glm::uvec3> attrib_offsets(num_chunks + 1, glm::uvec3(0));
+    size_t unsupported_faces = 0;
+    for (size_t i = 0; i < num_chunks; ++i) {
+        attrib_offsets[i + 1] = attrib_offsets[i] + glm::uvec3(chunks[i].vertices.size() / 3,
+                                                               chunks[i].normals.size() / 3,
+                                                               chunks[i].texcoords.size() / 2);
+        unsupported_faces += chunks[i].unsupported_faces;
+    }
+    if (unsupported_faces > 0) {
+        warn += "Skipped " + std::to_string(unsupported_faces) +
+                " faces with fewer than 3 valid vertices\n";
+    }
+    attrib.vertices.resize(size_t(attrib_offsets[num_chunks].x) * 3);
+    attrib.normals.resize(size_t(attrib_offsets[num_chunks].y) * 3);
+    attrib.texcoords.resize(size_t(attrib_offsets[num_chunks].z) * 2);
+
+    // Missing normals and texcoords are -1, relative indices resolving to -1 reach back past
+    // the start of the file
+    const glm::uvec3 attrib_counts = attrib_offsets[num_chunks];
+    auto in_range = [](const int index, const bool relative, const uint32_t count) {
+        return index >= 0 ? uint32_t(index) < count : index == -1 && !relative;
+    };
+    parallel_for(0, num_chunks, [&](const size_t i) {
+        auto &c = chunks[i];
+        const glm::uvec3 offset = attrib_offsets[i];
+        std::copy(c.vertices.begin(),
+                  c.vertices.end(),
+                  attrib.vertices.begin() + size_t(offset.x) * 3);
+        std::copy(
+            c.normals.begin(), c.normals.end(), attrib.normals.begin() + size_t(offset.y) * 3);
+        std::copy(c.texcoords.begin(),
+                  c.texcoords.end(),
+                  attrib.texcoords.begin() + size_t(offset.z) * 2);
+        std::vector<float>().swap(c.vertices);
+        std::vector<float>().swap(c.normals);
+        std::vector<float>().swap(c.texcoords);
+
+        for (size_t j = 0; j < c.indices.size(); ++j) {
+            if (c.relative[j] & RELATIVE_VERTEX) {
+                c.indices[j].vertex_index += offset.x;
+            }
+            if (c.relative[j] & RELATIVE_NORMAL) {
+                c.indices[j].normal_index += offset.y;
+            }
+            if (c.relative[j] & RELATIVE_TEXCOORD) {
+                c.indices[j].texcoord_index += offset.z;
+            }
+        }
+
+        c.invalid_triangles.resize(c.indices.size() / 3, false);
+        for (size_t j = 0; j < c.indices.size(); ++j) {
+            const tinyobj::index_t &index = c.indices[j];
+            const uint8_t rel = c.relative[j];
+            if (!in_range(index.vertex_index, rel & RELATIVE_VERTEX, attrib_counts.x) ||
+                !in_range(index.normal_index, rel & RELATIVE_NORMAL, attrib_counts.y) ||
+                !in_range(index.texcoord_index, rel & RELATIVE_TEXCOORD, attrib_counts.z)) {
+                c.invalid_triangles[j / 3] = true;
+            }
+        }
+        c.num_invalid_triangles =
+            std::count(c.invalid_triangles.begin(), c.invalid_triangles.end(), true);
+    });
+
+    size_t invalid_triangles = 0;
+    for (const auto &c : chunks) {
+        invalid_triangles += c.num_invalid_triangles;
+    }
+    if (invalid_triangles > 0) {
+        warn += "Skipped " + std::to_string(invalid_triangles) +
+                " triangles with out of range vertex, normal or texcoord indices\n";
+    }
+
+    // Gather the triangles into shapes. A chunk's triangles before its first o or g
+    // statement continue the previous chunk's shape and material
+    tinyobj::shape_t shape;
+    int material_id = -1;
+    auto finish_shape = [&]() {
+        if (!shape.mesh.indices.empty()) {
+            shapes.push_back(std::move(shape));
+        }
+        shape = tinyobj::shape_t();
+    };
+    for (const auto &c : chunks) {
+        size_t triangle = 0;
+        auto append_triangles = [&](const size_t end) {
+            if (c.num_invalid_triangles == 0) {
+                shape.mesh.indices.insert(shape.mesh.indices.end(),
+                                          c.indices.begin() + triangle * 3,
+                                          c.indices.begin() + end * 3);
+                shape.mesh.num_face_vertices.insert(
+                    shape.mesh.num_face_vertices.end(), end - triangle, 3);
+                shape.mesh.material_ids.insert(
+                    shape.mesh.material_ids.end(), end - triangle, material_id);
+            } else {
+                for (size_t t = triangle; t < end; ++t) {
+                    if (c.invalid_triangles[t]) {
+                        continue;
+                    }
+                    shape.mesh.indices.insert(shape.mesh.indices.end(),
+                                              c.indices.begin() + t * 3,
+                                              c.indices.begin() + t * 3 + 3);
+                    shape.mesh.num_face_vertices.push_back(3);
+                    shape.mesh.material_ids.push_back(material_id);
+                }
+            }
+            triangle = end;
+        };
+        for (const auto &e : c.events) {
+            append_triangles(e.triangle);
+            if (e.new_shape) {
+                finish_shape();
+                shape.name = e.name;
+            } else {
+                auto fnd = material_map.find(e.name);
+                if (fnd != material_map.end()) {
+                    material_id = fnd->second;
+                } else {
+                    warn += "Material '" + e.name + "' not found\n";
+                    material_id = -1;
+                }
+            }
+        }
+        append_triangles(c.indices.size() / 3);
+    }
+    finish_shape();
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+#include <vector>
+#include "tiny_obj_loader.h"
+
+/* Load the triangulated OBJ file and its materials into the same attribute, shape and
+ * material data tinyobj::LoadObj produces. The file is memory mapped and split at line
+ * boundaries into chunks which are parsed in parallel, then the chunks' attributes and
+ * faces are merged. Supports the v, vn, vt, f, o, g, usemtl and mtllib statements, others
+ * are ignored. Polygons are fan triangulated, so they must be convex. Throws a
+ * std::runtime_error if the file can't be loaded
+ */
+void load_obj_parallel(const std::string &file,
+                       const std::string &mtl_base_dir,
+                       tinyobj::attrib_t &attrib,
+                       std::vector<tinyobj::shape_t> &shapes,
+                       std::vector<tinyobj::material_t> &materials,
+                       std::string &warn);
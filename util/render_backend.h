@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include "integrator.h"
 #include "scene.h"
 #include <glm/glm.hpp>
 
@@ -9,6 +10,40 @@ struct RenderStats {
     float rays_per_second = 0;
 };
 
+/* Threading and memory options for the backends which render on the CPU, the GPU backends
+ * ignore them
+ */
+struct CPUOptions {
+    // Number of render threads, 0 to use all the hardware threads which aren't reserved
+    uint32_t num_threads = 0;
+    // Number of hardware threads to leave free for the UI and scene loading
+    uint32_t reserved_threads = 0;
+    bool pin_threads = false;
+    bool huge_pages = false;
+    // Render each NUMA node's share of the image with threads restricted to the node,
+    // optionally with a replica of the scene data in the node's memory
+    bool numa = false;
+    bool numa_replicate = false;
+    // Find the fastest tile size and scheduling for the scene on this machine
+    bool autotune = false;
+    // Have SIMD lanes whose path ended start the next pixel's path instead of idling
+    bool path_regeneration = false;
+};
+
+/* The integrator to render with, one of the INTEGRATOR_* values in integrator.h, and the
+ * settings for the ambient occlusion preview
+ */
+struct IntegratorParams {
+    uint32_t integrator = INTEGRATOR_PATH_TRACER;
+    uint32_t ao_samples = 4;
+    // The occlusion ray length as a fraction of the scene's bounding box diagonal
+    float ao_radius = 0.1f;
+};
+
+// The smallest fraction of the framebuffer resolution used when rendering at a reduced
+// resolution, below this the upscaled image is too blurry to navigate with
+const float MIN_RENDER_SCALE = 0.25f;
+
 struct RenderBackend {
     std::vector<uint32_t> img;
 
@@ -16,8 +51,62 @@ struct RenderBackend {
 
     virtual std::string name() = 0;
 
+    // Called before initialize and set_scene
+    virtual void set_cpu_options(const CPUOptions &) {}
+
     virtual void initialize(const int fb_width, const int fb_height) = 0;
 
+    // The number of instancing levels the backend can trace. Scenes with deeper instance
+    // group hierarchies are flattened before being passed to set_scene
+    virtual size_t max_instance_levels()
+    {
+        return 1;
+    }
+
+    // Render subsequent frames at the given fraction of the framebuffer resolution, clamped
+    // to [MIN_RENDER_SCALE, 1], and upscale them to fill the framebuffer, returns false if
+    // the backend doesn't support rendering at a reduced resolution. The caller resets
+    // accumulation when changing it
+    virtual bool set_render_scale(const float)
+    {
+        return false;
+    }
+
+    // Keep the accumulated samples when the camera moves or the render scale changes by
+    // reprojecting them into the new view, returns false if the backend doesn't support
+    // temporal reprojection
+    virtual bool set_temporal_reprojection(const bool)
+    {
+        return false;
+    }
+
+    // Select the integrator used for the following frames, returns false if the backend only
+    // supports the path tracer. The caller resets accumulation when changing integrators
+    virtual bool set_integrator(const IntegratorParams &)
+    {
+        return false;
+    }
+
+    // Cache the primary hits for the given number of fixed pixel jitter patterns while the
+    // camera is static, 0 to disable the cache. Returns false if not supported
+    virtual bool set_primary_hit_cache(const uint32_t)
+    {
+        return false;
+    }
+
+    // Replace the scene's materials or lights without rebuilding the scene, returns false
+    // if the backend requires a new set_scene call. The number of materials and the
+    // textures they reference must be unchanged. The caller resets accumulation
+    virtual bool update_materials(const std::vector<DisneyMaterial> &)
+    {
+        return false;
+    }
+
+    virtual bool update_lights(const std::vector<QuadLight> &)
+    {
+        return false;
+    }
+
     // TODO Probably should take the scene through a shared_ptr
     virtual void set_scene(const Scene &scene) = 0;
 
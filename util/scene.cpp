@@ -1,15 +1,26 @@
 #include "scene.h"
 #include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <limits>
+#include <map>
 #include <numeric>
 #include <stdexcept>
+#include <tuple>
 #include <vector>
 #include "buffer_view.h"
+#include "crts.h"
 #include "file_mapping.h"
 #include "flatten_gltf.h"
+#include "geometry_optimize.h"
+#include "gltf_meshopt.h"
 #include "gltf_types.h"
 #include "json.hpp"
+#include "obj_parser.h"
 #include "phmap_utils.h"
+#include "scene_cache.h"
 #include "stb_image.h"
 #include "tiny_gltf.h"
 #include "tiny_obj_loader.h"
@@ -46,8 +57,19 @@ bool operator==(const glm::uvec3 &a, const glm::uvec3 &b)
     return a.x == b.x && a.y == b.y && a.z == b.z;
 }
 
-Scene::Scene(const std::string &fname)
+Scene::Scene(const std::string &fname, const std::string &cache_dir)
 {
+    uint64_t content_hash = 0;
+    std::string cache_file;
+    if (!cache_dir.empty()) {
+        content_hash = hash_scene_file(fname);
+        cache_file = scene_cache_file(cache_dir, content_hash);
+        if (load_scene_cache(cache_file, content_hash, *this)) {
+            std::cout << "Loaded scene " << fname << " from cache " << cache_file << "\n";
+            return;
+        }
+    }
+
     const std::string ext = get_file_extension(fname);
     if (ext == "obj") {
         load_obj(fname);
@@ -63,6 +85,26 @@ Scene::Scene(const std::string &fname)
         std::cout << "Unsupported file type '" << ext << "'\n";
         throw std::runtime_error("Unsupported file type " + ext);
     }
+
+    deduplicate();
+
+    // Find any regular grid meshes (terrain, height fields, scans) that backends can
+    // represent without an index buffer
+    size_t num_grids = 0;
+    for (auto &m : meshes) {
+        for (auto &g : m.geometries) {
+            if (g.is_grid() || g.detect_grid()) {
+                ++num_grids;
+            }
+        }
+    }
+    if (num_grids > 0) {
+        std::cout << "Found " << num_grids << " regular grid geometries\n";
+    }
+
+    if (!cache_file.empty()) {
+        save_scene_cache(cache_file, content_hash, *this);
+    }
 }
 
 size_t Scene::unique_tris() const
@@ -75,11 +117,34 @@ size_t Scene::unique_tris() const
 
 size_t Scene::total_tris() const
 {
-    return std::accumulate(
-        instances.begin(), instances.end(), 0, [&](const size_t &n, const Instance &i) {
-            return n +
-                   meshes[parameterized_meshes[i.parameterized_mesh_id].mesh_id].num_tris();
-        });
+    auto count_instance_tris = [&](const std::vector<Instance> &insts) {
+        return std::accumulate(
+            insts.begin(), insts.end(), size_t(0), [&](const size_t &n, const Instance &i) {
+                const auto &pm = parameterized_meshes[i.parameterized_mesh_id];
+                return n + meshes[pm.mesh_id].num_tris();
+            });
+    };
+
+    // Count the triangles in each instance group, memoized since groups can be instanced
+    // many times at different levels
+    std::vector<size_t> group_tris(instance_groups.size(), -1);
+    std::function<size_t(size_t)> count_group_tris = [&](size_t id) {
+        if (group_tris[id] == size_t(-1)) {
+            const auto &g = instance_groups[id];
+            size_t n = count_instance_tris(g.instances);
+            for (const auto &gi : g.group_instances) {
+                n += count_group_tris(gi.group_id);
+            }
+            group_tris[id] = n;
+        }
+        return group_tris[id];
+    };
+
+    size_t n = count_instance_tris(instances);
+    for (const auto &gi : group_instances) {
+        n += count_group_tris(gi.group_id);
+    }
+    return n;
 }
 
 size_t Scene::num_geometries() const
@@ -90,29 +155,565 @@ size_t Scene::num_geometries() const
         });
 }
 
+size_t Scene::instance_levels() const
+{
+    std::vector<size_t> group_levels(instance_groups.size(), 0);
+    std::function<size_t(size_t)> count_group_levels = [&](size_t id) {
+        if (group_levels[id] == 0) {
+            size_t levels = 1;
+            for (const auto &gi : instance_groups[id].group_instances) {
+                levels = std::max(levels, 1 + count_group_levels(gi.group_id));
+            }
+            group_levels[id] = levels;
+        }
+        return group_levels[id];
+    };
+
+    size_t levels = 1;
+    for (const auto &gi : group_instances) {
+        levels = std::max(levels, 1 + count_group_levels(gi.group_id));
+    }
+    return levels;
+}
+
+void Scene::flatten_instance_groups()
+{
+    std::function<void(size_t, const glm::mat4 &)> flatten_group =
+        [&](size_t id, const glm::mat4 &transform) {
+            const auto &g = instance_groups[id];
+            for (const auto &i : g.instances) {
+                instances.emplace_back(transform * i.transform, i.parameterized_mesh_id);
+            }
+            for (const auto &gi : g.group_instances) {
+                flatten_group(gi.group_id, transform * gi.transform);
+            }
+        };
+
+    for (const auto &gi : group_instances) {
+        flatten_group(gi.group_id, gi.transform);
+    }
+    group_instances.clear();
+    instance_groups.clear();
+}
+
+void Scene::merge_instances(const size_t max_instance_count)
+{
+    std::vector<size_t> mesh_instance_count(meshes.size(), 0);
+    for (const auto &i : instances) {
+        ++mesh_instance_count[parameterized_meshes[i.parameterized_mesh_id].mesh_id];
+    }
+    // Meshes instanced within instance groups are left in place
+    std::vector<bool> mesh_in_group(meshes.size(), false);
+    for (const auto &g : instance_groups) {
+        for (const auto &i : g.instances) {
+            mesh_in_group[parameterized_meshes[i.parameterized_mesh_id].mesh_id] = true;
+        }
+    }
+    auto keep_mesh = [&](const size_t mesh_id) {
+        return mesh_instance_count[mesh_id] > max_instance_count || mesh_in_group[mesh_id];
+    };
+
+    std::vector<Instance> kept_instances;
+    std::vector<Instance> baked_instances;
+    for (const auto &i : instances) {
+        const size_t mesh_id = parameterized_meshes[i.parameterized_mesh_id].mesh_id;
+        if (!keep_mesh(mesh_id)) {
+            baked_instances.push_back(i);
+        } else {
+            kept_instances.push_back(i);
+        }
+    }
+    if (baked_instances.size() < 2) {
+        std::cout << "No instances to merge\n";
+        return;
+    }
+
+    // Sort the instances to bake along a Morton curve through their world space centers so
+    // that each merged mesh covers a compact region of the scene
+    glm::vec3 scene_min(std::numeric_limits<float>::infinity());
+    glm::vec3 scene_max(-std::numeric_limits<float>::infinity());
+    std::vector<glm::vec3> centers;
+    centers.reserve(baked_instances.size());
+    for (const auto &i : baked_instances) {
+        const auto &mesh = meshes[parameterized_meshes[i.parameterized_mesh_id].mesh_id];
+        glm::vec3 mesh_min(std::numeric_limits<float>::infinity());
+        glm::vec3 mesh_max(-std::numeric_limits<float>::infinity());
+        for (const auto &g : mesh.geometries) {
+            for (const auto &v : g.vertices) {
+                mesh_min = glm::min(mesh_min, v);
+                mesh_max = glm::max(mesh_max, v);
+            }
+        }
+        if (mesh_min.x > mesh_max.x) {
+            mesh_min = mesh_max = glm::vec3(0.f);
+        }
+        const glm::vec3 c =
+            glm::vec3(i.transform * glm::vec4(0.5f * (mesh_min + mesh_max), 1.f));
+        scene_min = glm::min(scene_min, c);
+        scene_max = glm::max(scene_max, c);
+        centers.push_back(c);
+    }
+    const glm::vec3 scene_extent = glm::max(scene_max - scene_min, glm::vec3(1e-6f));
+    std::vector<std::pair<uint32_t, size_t>> morton_order;
+    morton_order.reserve(centers.size());
+    for (size_t i = 0; i < centers.size(); ++i) {
+        const glm::vec3 p = 1023.f * (centers[i] - scene_min) / scene_extent;
+        morton_order.emplace_back(morton_code3(glm::uvec3(p)), i);
+    }
+    std::sort(morton_order.begin(), morton_order.end());
+
+    // Merged meshes are capped in size so the BVH builds can still run in parallel
+    const size_t max_merged_tris = 16 * 1024 * 1024;
+    std::vector<Mesh> merged_meshes(1);
+    std::vector<std::vector<uint32_t>> merged_material_ids(1);
+    size_t merged_tris = 0;
+    for (const auto &o : morton_order) {
+        const auto &inst = baked_instances[o.second];
+        const auto &pm = parameterized_meshes[inst.parameterized_mesh_id];
+        const auto &mesh = meshes[pm.mesh_id];
+        if (merged_tris > 0 && merged_tris + mesh.num_tris() > max_merged_tris) {
+            merged_meshes.emplace_back();
+            merged_material_ids.emplace_back();
+            merged_tris = 0;
+        }
+        merged_tris += mesh.num_tris();
+
+        const glm::mat3 normal_transform =
+            glm::transpose(glm::inverse(glm::mat3(inst.transform)));
+        // Mirroring transforms flip the winding order, which we undo to keep the geometric
+        // normal facing the same way it did in the instance
+        const bool flip_winding = glm::determinant(glm::mat3(inst.transform)) < 0.f;
+        for (size_t j = 0; j < mesh.geometries.size(); ++j) {
+            Geometry geom = mesh.geometries[j];
+            glm::vec3 *verts = geom.vertices.mutable_data();
+            for (size_t k = 0; k < geom.vertices.size(); ++k) {
+                verts[k] = glm::vec3(inst.transform * glm::vec4(verts[k], 1.f));
+            }
+            glm::vec3 *normals = geom.normals.mutable_data();
+            for (size_t k = 0; k < geom.normals.size(); ++k) {
+                normals[k] = glm::normalize(normal_transform * normals[k]);
+            }
+            if (flip_winding) {
+                glm::uvec3 *indices = geom.indices.mutable_data();
+                for (size_t k = 0; k < geom.indices.size(); ++k) {
+                    std::swap(indices[k].y, indices[k].z);
+                }
+                geom.grid_dims = glm::uvec2(0);
+            }
+            merged_meshes.back().geometries.push_back(geom);
+            merged_material_ids.back().push_back(pm.material_ids[j]);
+        }
+    }
+
+    // Compact the meshes and parameterized meshes down to those still used by the kept
+    // instances, then append the merged meshes
+    size_t num_kept_meshes = 0;
+    size_t duplicated_tris = 0;
+    std::vector<size_t> mesh_remap(meshes.size(), -1);
+    std::vector<Mesh> new_meshes;
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        if (keep_mesh(i)) {
+            mesh_remap[i] = new_meshes.size();
+            new_meshes.push_back(std::move(meshes[i]));
+            ++num_kept_meshes;
+        } else if (mesh_instance_count[i] > 1) {
+            duplicated_tris += (mesh_instance_count[i] - 1) * meshes[i].num_tris();
+        }
+    }
+
+    std::vector<size_t> param_mesh_remap(parameterized_meshes.size(), -1);
+    std::vector<ParameterizedMesh> new_parameterized_meshes;
+    auto remap_parameterized_mesh = [&](Instance &i) {
+        size_t &id = param_mesh_remap[i.parameterized_mesh_id];
+        if (id == size_t(-1)) {
+            id = new_parameterized_meshes.size();
+            ParameterizedMesh pm = parameterized_meshes[i.parameterized_mesh_id];
+            pm.mesh_id = mesh_remap[pm.mesh_id];
+            new_parameterized_meshes.push_back(pm);
+        }
+        i.parameterized_mesh_id = id;
+    };
+    std::for_each(kept_instances.begin(), kept_instances.end(), remap_parameterized_mesh);
+    for (auto &g : instance_groups) {
+        std::for_each(g.instances.begin(), g.instances.end(), remap_parameterized_mesh);
+    }
+
+    for (size_t i = 0; i < merged_meshes.size(); ++i) {
+        kept_instances.emplace_back(glm::mat4(1.f), new_parameterized_meshes.size());
+        new_parameterized_meshes.emplace_back(new_meshes.size(), merged_material_ids[i]);
+        new_meshes.push_back(std::move(merged_meshes[i]));
+    }
+
+    std::cout << "Merged " << baked_instances.size() << " instances into "
+              << merged_meshes.size() << " meshes, duplicating "
+              << pretty_print_count(duplicated_tris) << " triangles by baking\n"
+              << "Kept " << kept_instances.size() - merged_meshes.size() << " instances of "
+              << num_kept_meshes << " meshes instanced more than " << max_instance_count
+              << " times or within instance groups\n";
+
+    meshes = std::move(new_meshes);
+    parameterized_meshes = std::move(new_parameterized_meshes);
+    instances = std::move(kept_instances);
+}
+
+/* Move an owned attribute buffer into shared storage, padded to meet the AttributeBuffer
+ * external buffer requirements, so that copies of it reference the same data
+ */
+template <typename T>
+static void make_shared_attribute(AttributeBuffer<T> &attrib)
+{
+    if (attrib.is_external() || attrib.empty()) {
+        return;
+    }
+    auto data =
+        std::make_shared<std::vector<T>>(attrib.size() + (16 + sizeof(T) - 1) / sizeof(T));
+    std::copy(attrib.begin(), attrib.end(), data->begin());
+    attrib = AttributeBuffer<T>(data->data(), attrib.size(), data);
+}
+
+void Scene::optimize_meshes()
+{
+    // Geometries using the same buffers, e.g., shared by deduplicate or the scene cache, are
+    // optimized once and share the result. Geometries sharing only some of their buffers
+    // get their own optimized copies, since the vertex order depends on the triangles
+    using GeometryBuffers = std::tuple<const void *, const void *, const void *, const void *>;
+    std::map<GeometryBuffers, Geometry *> unique_geometries;
+    std::vector<std::pair<Geometry *, Geometry *>> shared_geometries;
+
+    // Large geometries are optimized one at a time, each using all the threads, and the rest
+    // in parallel with each other
+    const size_t large_geometry_tris = 1024 * 1024;
+    std::vector<Geometry *> large_geometries;
+    std::vector<Geometry *> small_geometries;
+    for (auto &m : meshes) {
+        for (auto &g : m.geometries) {
+            const GeometryBuffers buffers(
+                g.vertices.data(), g.normals.data(), g.uvs.data(), g.indices.data());
+            auto fnd = unique_geometries.find(buffers);
+            if (fnd != unique_geometries.end()) {
+                shared_geometries.emplace_back(&g, fnd->second);
+                continue;
+            }
+            unique_geometries[buffers] = &g;
+
+            if (g.num_tris() >= large_geometry_tris) {
+                large_geometries.push_back(&g);
+            } else {
+                small_geometries.push_back(&g);
+            }
+        }
+    }
+
+    std::atomic<size_t> welded_vertices(0);
+    std::atomic<size_t> unused_vertices(0);
+    auto optimize = [&](Geometry &g, const bool parallel) {
+        const GeometryOptimizeStats stats = optimize_geometry(g, parallel);
+        welded_vertices += stats.welded_vertices;
+        unused_vertices += stats.unused_vertices;
+    };
+    for (auto *g : large_geometries) {
+        optimize(*g, true);
+    }
+    parallel_for(0, small_geometries.size(), [&](const size_t i) {
+        optimize(*small_geometries[i], false);
+    });
+    for (auto &g : shared_geometries) {
+        Geometry &optimized = *g.second;
+        make_shared_attribute(optimized.vertices);
+        make_shared_attribute(optimized.normals);
+        make_shared_attribute(optimized.uvs);
+        make_shared_attribute(optimized.indices);
+        *g.first = optimized;
+    }
+    std::cout << "Optimized " << large_geometries.size() + small_geometries.size()
+              << " geometries, welding " << pretty_print_count(welded_vertices)
+              << " duplicate vertices and removing " << pretty_print_count(unused_vertices)
+              << " unused vertices\n";
+}
+
+template <typename T>
+static uint64_t hash_attribute(const AttributeBuffer<T> &attrib)
+{
+    return hash_bytes(attrib.data(), attrib.size() * sizeof(T), 0);
+}
+
+template <typename T>
+static bool same_attribute(const AttributeBuffer<T> &a, const AttributeBuffer<T> &b)
+{
+    return a.size() == b.size() &&
+           (a.data() == b.data() ||
+            std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0);
+}
+
+static bool same_mesh(const Mesh &a, const Mesh &b)
+{
+    if (a.geometries.size() != b.geometries.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.geometries.size(); ++i) {
+        const Geometry &ga = a.geometries[i];
+        const Geometry &gb = b.geometries[i];
+        if (ga.grid_dims != gb.grid_dims || !same_attribute(ga.vertices, gb.vertices) ||
+            !same_attribute(ga.normals, gb.normals) || !same_attribute(ga.uvs, gb.uvs) ||
+            !same_attribute(ga.indices, gb.indices)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t mesh_bytes(const Mesh &m)
+{
+    size_t bytes = 0;
+    for (const auto &g : m.geometries) {
+        bytes += g.vertices.size() * sizeof(glm::vec3) + g.normals.size() * sizeof(glm::vec3) +
+                 g.uvs.size() * sizeof(glm::vec2) + g.indices.size() * sizeof(glm::uvec3);
+    }
+    return bytes;
+}
+
+static bool same_image(const Image &a, const Image &b)
+{
+    return a.width == b.width && a.height == b.height && a.channels == b.channels &&
+           a.color_space == b.color_space && a.img == b.img;
+}
+
+/* Find the unique items given their hashes, returning the index of each item's unique copy
+ * in the compacted list of unique items. The unique items are appended to unique_items
+ */
+template <typename T, typename Same>
+static std::vector<size_t> find_duplicates(const std::vector<T> &items,
+                                           const std::vector<uint64_t> &hashes,
+                                           const Same &same,
+                                           std::vector<size_t> &unique_items)
+{
+    phmap::flat_hash_map<uint64_t, std::vector<size_t>> candidates;
+    std::vector<size_t> remap(items.size(), -1);
+    for (size_t i = 0; i < items.size(); ++i) {
+        auto &matches = candidates[hashes[i]];
+        for (const size_t j : matches) {
+            if (same(items[unique_items[j]], items[i])) {
+                remap[i] = j;
+                break;
+            }
+        }
+        if (remap[i] == size_t(-1)) {
+            remap[i] = unique_items.size();
+            matches.push_back(unique_items.size());
+            unique_items.push_back(i);
+        }
+    }
+    return remap;
+}
+
+/* Have identical attribute buffers reference a single copy of the data. Owned buffers are
+ * moved into shared storage, padded to meet the AttributeBuffer external buffer requirements.
+ * Returns the number of bytes saved
+ */
+template <typename T>
+static size_t share_attributes(const std::vector<AttributeBuffer<T> *> &attribs,
+                               const std::vector<uint64_t> &hashes)
+{
+    std::vector<size_t> unique_attribs;
+    const std::vector<size_t> remap = find_duplicates(
+        attribs,
+        hashes,
+        [](const AttributeBuffer<T> *a, const AttributeBuffer<T> *b) {
+            return same_attribute(*a, *b);
+        },
+        unique_attribs);
+
+    size_t bytes_saved = 0;
+    for (size_t i = 0; i < attribs.size(); ++i) {
+        AttributeBuffer<T> &shared = *attribs[unique_attribs[remap[i]]];
+        AttributeBuffer<T> &attrib = *attribs[i];
+        if (&shared == &attrib || shared.data() == attrib.data() || attrib.empty()) {
+            continue;
+        }
+        make_shared_attribute(shared);
+        bytes_saved += attrib.size() * sizeof(T);
+        attrib = AttributeBuffer<T>(shared.data(), shared.size(), shared.owner());
+    }
+    return bytes_saved;
+}
+
+void Scene::deduplicate()
+{
+    // Hash the geometry buffers and texture pixels in parallel
+    std::vector<std::pair<size_t, size_t>> geometry_ids;
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        for (size_t j = 0; j < meshes[i].geometries.size(); ++j) {
+            geometry_ids.emplace_back(i, j);
+        }
+    }
+    // The hashes of each geometry's vertices, normals, uvs and indices
+    std::vector<std::array<uint64_t, 4>> attribute_hashes(geometry_ids.size());
+    parallel_for(0, geometry_ids.size(), [&](const size_t i) {
+        const Geometry &g = meshes[geometry_ids[i].first].geometries[geometry_ids[i].second];
+        attribute_hashes[i] = {hash_attribute(g.vertices),
+                               hash_attribute(g.normals),
+                               hash_attribute(g.uvs),
+                               hash_attribute(g.indices)};
+    });
+    std::vector<uint64_t> texture_hashes(textures.size());
+    parallel_for(0, textures.size(), [&](const size_t i) {
+        const Image &t = textures[i];
+        const int header[] = {t.width, t.height, t.channels, int(t.color_space)};
+        texture_hashes[i] =
+            hash_bytes(t.img.data(), t.img.size(), hash_bytes(header, sizeof(header), 0));
+    });
+
+    std::vector<uint64_t> mesh_hashes(meshes.size(), 0);
+    for (size_t i = 0; i < geometry_ids.size(); ++i) {
+        const Geometry &g = meshes[geometry_ids[i].first].geometries[geometry_ids[i].second];
+        uint64_t &h = mesh_hashes[geometry_ids[i].first];
+        h = hash_bytes(attribute_hashes[i].data(), sizeof(attribute_hashes[i]), h);
+        h = hash_bytes(&g.grid_dims, sizeof(glm::uvec2), h);
+    }
+
+    std::vector<size_t> unique_meshes;
+    const std::vector<size_t> mesh_remap =
+        find_duplicates(meshes, mesh_hashes, same_mesh, unique_meshes);
+    std::vector<size_t> unique_textures;
+    const std::vector<size_t> texture_remap =
+        find_duplicates(textures, texture_hashes, same_image, unique_textures);
+
+    size_t mesh_bytes_saved = 0;
+    std::vector<bool> kept_mesh(meshes.size(), false);
+    std::vector<Mesh> new_meshes;
+    new_meshes.reserve(unique_meshes.size());
+    for (size_t i = 0; i < meshes.size(); ++i) {
+        if (new_meshes.size() == mesh_remap[i]) {
+            new_meshes.push_back(std::move(meshes[i]));
+            kept_mesh[i] = true;
+        } else {
+            mesh_bytes_saved += mesh_bytes(meshes[i]);
+        }
+    }
+
+    // Parameterized meshes of the same mesh with the same materials are now identical too
+    std::map<std::pair<size_t, std::vector<uint32_t>>, size_t> param_mesh_ids;
+    std::vector<size_t> param_mesh_remap(parameterized_meshes.size());
+    std::vector<ParameterizedMesh> new_parameterized_meshes;
+    for (size_t i = 0; i < parameterized_meshes.size(); ++i) {
+        ParameterizedMesh pm = parameterized_meshes[i];
+        pm.mesh_id = mesh_remap[pm.mesh_id];
+        const auto key = std::make_pair(pm.mesh_id, pm.material_ids);
+        auto fnd = param_mesh_ids.find(key);
+        if (fnd != param_mesh_ids.end()) {
+            param_mesh_remap[i] = fnd->second;
+        } else {
+            param_mesh_remap[i] = new_parameterized_meshes.size();
+            param_mesh_ids[key] = param_mesh_remap[i];
+            new_parameterized_meshes.push_back(pm);
+        }
+    }
+    for (auto &inst : instances) {
+        inst.parameterized_mesh_id = param_mesh_remap[inst.parameterized_mesh_id];
+    }
+    for (auto &g : instance_groups) {
+        for (auto &inst : g.instances) {
+            inst.parameterized_mesh_id = param_mesh_remap[inst.parameterized_mesh_id];
+        }
+    }
+
+    // Meshes which aren't identical can still share some of their buffers, e.g., glTF
+    // primitives using the same position accessor with different index accessors
+    std::vector<AttributeBuffer<glm::vec3> *> vertices, normals;
+    std::vector<AttributeBuffer<glm::vec2> *> uvs;
+    std::vector<AttributeBuffer<glm::uvec3> *> indices;
+    std::array<std::vector<uint64_t>, 4> kept_attribute_hashes;
+    for (size_t i = 0; i < geometry_ids.size(); ++i) {
+        if (!kept_mesh[geometry_ids[i].first]) {
+            continue;
+        }
+        Geometry &g =
+            new_meshes[mesh_remap[geometry_ids[i].first]].geometries[geometry_ids[i].second];
+        vertices.push_back(&g.vertices);
+        normals.push_back(&g.normals);
+        uvs.push_back(&g.uvs);
+        indices.push_back(&g.indices);
+        for (size_t j = 0; j < 4; ++j) {
+            kept_attribute_hashes[j].push_back(attribute_hashes[i][j]);
+        }
+    }
+    const size_t attribute_bytes_saved = share_attributes(vertices, kept_attribute_hashes[0]) +
+                                         share_attributes(normals, kept_attribute_hashes[1]) +
+                                         share_attributes(uvs, kept_attribute_hashes[2]) +
+                                         share_attributes(indices, kept_attribute_hashes[3]);
+
+    size_t texture_bytes_saved = 0;
+    std::vector<Image> new_textures;
+    new_textures.reserve(unique_textures.size());
+    for (size_t i = 0; i < textures.size(); ++i) {
+        if (new_textures.size() == texture_remap[i]) {
+            new_textures.push_back(std::move(textures[i]));
+        } else {
+            texture_bytes_saved += textures[i].img.size();
+        }
+    }
+    // Remap the texture IDs of textured material parameters, keeping their channels
+    for (auto &m : materials) {
+        float *params[] = {&m.base_color.x,
+                           &m.metallic,
+                           &m.specular,
+                           &m.roughness,
+                           &m.specular_tint,
+                           &m.anisotropy,
+                           &m.sheen,
+                           &m.sheen_tint,
+                           &m.clearcoat,
+                           &m.clearcoat_gloss,
+                           &m.ior,
+                           &m.specular_transmission};
+        for (float *p : params) {
+            uint32_t handle = 0;
+            std::memcpy(&handle, p, sizeof(float));
+            if (!IS_TEXTURED_PARAM(handle) || GET_TEXTURE_ID(handle) >= texture_remap.size()) {
+                continue;
+            }
+            uint32_t remapped = handle & ~uint32_t(0x1fffffff);
+            SET_TEXTURE_ID(remapped, uint32_t(texture_remap[GET_TEXTURE_ID(handle)]));
+            std::memcpy(p, &remapped, sizeof(float));
+        }
+    }
+
+    if (new_meshes.size() != meshes.size() || new_textures.size() != textures.size() ||
+        attribute_bytes_saved > 0) {
+        std::cout << "Deduplicated " << meshes.size() - new_meshes.size() << " meshes ("
+                  << pretty_print_count(mesh_bytes_saved) << "B), "
+                  << textures.size() - new_textures.size() << " textures ("
+                  << pretty_print_count(texture_bytes_saved) << "B) and shared "
+                  << pretty_print_count(attribute_bytes_saved) << "B of geometry buffers\n";
+    }
+
+    meshes = std::move(new_meshes);
+    parameterized_meshes = std::move(new_parameterized_meshes);
+    textures = std::move(new_textures);
+}
+
 void Scene::load_obj(const std::string &file)
 {
     std::cout << "Loading OBJ: " << file << "\n";
 
-    // Load the model w/ tinyobjloader. We just take any OBJ groups etc. stuff
+    // Load the model w/ the parallel OBJ parser. We just take any OBJ groups etc. stuff
     // that may be in the file and dump them all into a single OBJ model.
     tinyobj::attrib_t attrib;
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> obj_materials;
-    std::string err, warn;
+    std::string warn;
     const std::string obj_base_dir = file.substr(0, file.rfind('/'));
-    bool ret = tinyobj::LoadObj(
-        &attrib, &shapes, &obj_materials, &warn, &err, file.c_str(), obj_base_dir.c_str());
+    load_obj_parallel(file, obj_base_dir, attrib, shapes, obj_materials, warn);
     if (!warn.empty()) {
-        std::cout << "TinyOBJ loading '" << file << "': " << warn << "\n";
-    }
-    if (!ret || !err.empty()) {
-        throw std::runtime_error("TinyOBJ Error loading " + file + " error: " + err);
+        std::cout << "OBJ loading '" << file << "': " << warn << "\n";
     }
 
+    // Remap each shape's indices in parallel, the shapes are independent geometries
     Mesh mesh;
-    std::vector<uint32_t> material_ids;
-    for (size_t s = 0; s < shapes.size(); ++s) {
+    mesh.geometries.resize(shapes.size());
+    std::vector<uint32_t> material_ids(shapes.size());
+    std::atomic<bool> per_face_materials(false);
+    parallel_for(0, shapes.size(), [&](const size_t s) {
         // We load with triangulate on so we know the mesh will be all triangle faces
         const tinyobj::mesh_t &obj_mesh = shapes[s].mesh;
 
@@ -122,15 +723,12 @@ void Scene::load_obj(const std::string &file)
         phmap::parallel_flat_hash_map<glm::uvec3, uint32_t> index_mapping;
         Geometry geom;
         // Note: not supporting per-primitive materials
-        material_ids.push_back(obj_mesh.material_ids[0]);
+        material_ids[s] = obj_mesh.material_ids[0];
 
         auto minmax_matid =
             std::minmax_element(obj_mesh.material_ids.begin(), obj_mesh.material_ids.end());
         if (*minmax_matid.first != *minmax_matid.second) {
-            std::cout
-                << "Warning: per-face material IDs are not supported, materials may look "
-                   "wrong."
-                   " Please reexport your mesh with each material group as an OBJ group\n";
+            per_face_materials = true;
         }
 
         for (size_t f = 0; f < obj_mesh.num_face_vertices.size(); ++f) {
@@ -172,15 +770,21 @@ void Scene::load_obj(const std::string &file)
             }
             geom.indices.push_back(tri_indices);
         }
-        mesh.geometries.push_back(geom);
+        mesh.geometries[s] = std::move(geom);
+    });
+    if (per_face_materials) {
+        std::cout << "Warning: per-face material IDs are not supported, materials may look "
+                     "wrong."
+                     " Please reexport your mesh with each material group as an OBJ group\n";
     }
-    meshes.push_back(mesh);
+    meshes.push_back(std::move(mesh));
 
     // OBJ has a single "parameterized mesh" and "instance"
     parameterized_meshes.emplace_back(0, material_ids);
     instances.emplace_back(glm::mat4(1.f), 0);
 
     phmap::parallel_flat_hash_map<std::string, int32_t> texture_ids;
+    std::vector<ImageDecodeJob> decode_jobs;
     // Parse the materials over to a similar DisneyMaterial representation
     for (const auto &m : obj_materials) {
         DisneyMaterial d;
@@ -196,7 +800,15 @@ void Scene::load_obj(const std::string &file)
             canonicalize_path(path);
             if (texture_ids.find(m.diffuse_texname) == texture_ids.end()) {
                 texture_ids[m.diffuse_texname] = textures.size();
-                textures.emplace_back(obj_base_dir + "/" + path, m.diffuse_texname, SRGB);
+                ImageDecodeJob job;
+                job.image_id = textures.size();
+                job.file = obj_base_dir + "/" + path;
+                decode_jobs.push_back(job);
+
+                Image texture;
+                texture.name = m.diffuse_texname;
+                texture.color_space = SRGB;
+                textures.push_back(texture);
             }
             const int32_t id = texture_ids[m.diffuse_texname];
             uint32_t tex_mask = TEXTURED_PARAM_MASK;
@@ -205,6 +817,7 @@ void Scene::load_obj(const std::string &file)
         }
         materials.push_back(d);
     }
+    decode_images(decode_jobs, textures);
 
     validate_materials();
 
@@ -220,18 +833,118 @@ void Scene::load_obj(const std::string &file)
     lights.push_back(light);
 }
 
+// Keep the encoded image data instead of letting tinygltf decode each image while parsing,
+// so that the images can be decoded in parallel once the file is loaded
+static bool store_encoded_gltf_image(tinygltf::Image *image,
+                                     const int,
+                                     std::string *,
+                                     std::string *,
+                                     int,
+                                     int,
+                                     const unsigned char *bytes,
+                                     int size,
+                                     void *)
+{
+    image->image.assign(bytes, bytes + size);
+    return true;
+}
+
+// Load the primitive's attributes, converting them in bulk from the accessors
+static Geometry load_gltf_primitive(const tinygltf::Primitive &p, const tinygltf::Model &model)
+{
+    if (p.mode != TINYGLTF_MODE_TRIANGLES) {
+        std::cout << "Unsupported primitive mode! File must contain only triangles\n";
+        throw std::runtime_error("Unsupported primitive mode! Only triangles are supported");
+    }
+
+    Geometry geom;
+    auto fnd = p.attributes.find("POSITION");
+    if (fnd == p.attributes.end()) {
+        throw std::runtime_error("glTF primitive has no POSITION attribute");
+    }
+    const tinygltf::Accessor &pos_accessor = model.accessors.at(fnd->second);
+    geom.vertices.resize(pos_accessor.count);
+    read_gltf_floats(pos_accessor,
+                     model,
+                     3,
+                     reinterpret_cast<float *>(geom.vertices.mutable_data()));
+
+    // Note: GLTF can have multiple texture coordinates used by different textures
+    // (owch) I don't plan to support this
+    fnd = p.attributes.find("TEXCOORD_0");
+    if (fnd != p.attributes.end()) {
+        const tinygltf::Accessor &uv_accessor = model.accessors.at(fnd->second);
+        geom.uvs.resize(uv_accessor.count);
+        read_gltf_floats(
+            uv_accessor, model, 2, reinterpret_cast<float *>(geom.uvs.mutable_data()));
+    }
+
+#if 0
+    fnd = p.attributes.find("NORMAL");
+    if (fnd != p.attributes.end()) {
+        const tinygltf::Accessor &normal_accessor = model.accessors.at(fnd->second);
+        geom.normals.resize(normal_accessor.count);
+        read_gltf_floats(normal_accessor,
+                         model,
+                         3,
+                         reinterpret_cast<float *>(geom.normals.mutable_data()));
+    }
+#endif
+
+    if (p.indices < 0) {
+        throw std::runtime_error("Non-indexed glTF primitives are not supported");
+    }
+    const tinygltf::Accessor &index_accessor = model.accessors.at(p.indices);
+    geom.indices.resize(index_accessor.count / 3);
+    if (index_accessor.count % 3 == 0) {
+        read_gltf_indices(index_accessor,
+                          model,
+                          reinterpret_cast<uint32_t *>(geom.indices.mutable_data()));
+    } else {
+        std::vector<uint32_t> indices(index_accessor.count);
+        read_gltf_indices(index_accessor, model, indices.data());
+        std::memcpy(geom.indices.mutable_data(),
+                    indices.data(),
+                    geom.indices.size() * sizeof(glm::uvec3));
+    }
+    return geom;
+}
+
 void Scene::load_gltf(const std::string &fname)
 {
     std::cout << "Loading GLTF " << fname << "\n";
 
     tinygltf::Model model;
     tinygltf::TinyGLTF context;
+    context.SetImageLoader(store_encoded_gltf_image, nullptr);
     std::string err, warn;
     bool ret = false;
-    if (get_file_extension(fname) == "gltf") {
-        ret = context.LoadASCIIFromFile(&model, &err, &warn, fname.c_str());
-    } else {
-        ret = context.LoadBinaryFromFile(&model, &err, &warn, fname.c_str());
+    GLTFMeshoptFile meshopt;
+    {
+        // Parse the file directly from a mapping of it, instead of having TinyGLTF read it
+        // into memory first
+        const FileMapping mapping(fname);
+        const bool binary = get_file_extension(fname) != "gltf";
+        meshopt = read_gltf_meshopt(mapping.data(), mapping.nbytes(), binary);
+        // Files with EXT_meshopt_compression fallback buffers are loaded from a patched copy
+        const uint8_t *data = mapping.data();
+        size_t size = mapping.nbytes();
+        if (!meshopt.patched_file.empty()) {
+            data = meshopt.patched_file.data();
+            size = meshopt.patched_file.size();
+        }
+        if (size > std::numeric_limits<unsigned int>::max()) {
+            throw std::runtime_error("glTF file " + fname + " is too large to load");
+        }
+        const size_t slash = fname.find_last_of("/\\");
+        const std::string base_dir = slash == std::string::npos ? "" : fname.substr(0, slash);
+        if (!binary) {
+            ret = context.LoadASCIIFromString(
+                &model, &err, &warn, reinterpret_cast<const char *>(data), size, base_dir);
+        } else {
+            ret = context.LoadBinaryFromMemory(&model, &err, &warn, data, size, base_dir);
+        }
+        meshopt.patched_file = std::vector<uint8_t>();
     }
 
     if (!warn.empty()) {
@@ -246,95 +959,49 @@ void Scene::load_gltf(const std::string &fname)
         model.defaultScene = 0;
     }
 
+    decode_gltf_meshopt(meshopt.views, model);
+
     flatten_gltf(model);
 
     // Load the meshes. Note: GLTF combines mesh + material parameters into
     // a single entity, so GLTF "meshes" are ChameleonRT "parameterized meshes"
-    for (auto &m : model.meshes) {
-        Mesh mesh;
+    const size_t mesh_offset = meshes.size();
+    std::vector<std::pair<size_t, size_t>> primitives;
+    for (size_t i = 0; i < model.meshes.size(); ++i) {
+        const auto &m = model.meshes[i];
         std::vector<uint32_t> material_ids;
-        for (auto &p : m.primitives) {
-            Geometry geom;
-            material_ids.push_back(p.material);
-
-            if (p.mode != TINYGLTF_MODE_TRIANGLES) {
-                std::cout << "Unsupported primitive mode! File must contain only triangles\n";
-                throw std::runtime_error(
-                    "Unsupported primitive mode! Only triangles are supported");
-            }
-
-            // Note: assumes there is a POSITION (is this required by the gltf spec?)
-            Accessor<glm::vec3> pos_accessor(model.accessors[p.attributes["POSITION"]], model);
-            for (size_t i = 0; i < pos_accessor.size(); ++i) {
-                geom.vertices.push_back(pos_accessor[i]);
-            }
-
-            // Note: GLTF can have multiple texture coordinates used by different textures
-            // (owch) I don't plan to support this
-            auto fnd = p.attributes.find("TEXCOORD_0");
-            if (fnd != p.attributes.end()) {
-                Accessor<glm::vec2> uv_accessor(model.accessors[fnd->second], model);
-                for (size_t i = 0; i < uv_accessor.size(); ++i) {
-                    geom.uvs.push_back(uv_accessor[i]);
-                }
-            }
-
-#if 0
-            fnd = p.attributes.find("NORMAL");
-            if (fnd != p.attributes.end()) {
-                Accessor<glm::vec3> normal_accessor(model.accessors[fnd->second], model);
-                for (size_t i = 0; i < normal_accessor.size(); ++i) {
-                    geom.normals.push_back(normal_accessor[i]);
-                }
-            }
-#endif
-
-            if (model.accessors[p.indices].componentType ==
-                TINYGLTF_COMPONENT_TYPE_UNSIGNED_SHORT) {
-                Accessor<uint16_t> index_accessor(model.accessors[p.indices], model);
-                for (size_t i = 0; i < index_accessor.size() / 3; ++i) {
-                    geom.indices.push_back(glm::uvec3(index_accessor[i * 3],
-                                                      index_accessor[i * 3 + 1],
-                                                      index_accessor[i * 3 + 2]));
-                }
-            } else if (model.accessors[p.indices].componentType ==
-                       TINYGLTF_COMPONENT_TYPE_UNSIGNED_INT) {
-                Accessor<uint32_t> index_accessor(model.accessors[p.indices], model);
-                for (size_t i = 0; i < index_accessor.size() / 3; ++i) {
-                    geom.indices.push_back(glm::uvec3(index_accessor[i * 3],
-                                                      index_accessor[i * 3 + 1],
-                                                      index_accessor[i * 3 + 2]));
-                }
-            } else {
-                std::cout << "Unsupported index type\n";
-                throw std::runtime_error("Unsupported index component type");
-            }
-            mesh.geometries.push_back(geom);
+        for (size_t j = 0; j < m.primitives.size(); ++j) {
+            material_ids.push_back(m.primitives[j].material);
+            primitives.emplace_back(i, j);
         }
         parameterized_meshes.emplace_back(meshes.size(), material_ids);
-        meshes.push_back(mesh);
+        meshes.emplace_back(std::vector<Geometry>(m.primitives.size()));
     }
-
-    // Load images
+    // The primitives are loaded in parallel, since large scenes have many of them
+    parallel_for(0, primitives.size(), [&](const size_t i) {
+        const size_t mesh_id = primitives[i].first;
+        const size_t primitive_id = primitives[i].second;
+        meshes[mesh_offset + mesh_id].geometries[primitive_id] =
+            load_gltf_primitive(model.meshes[mesh_id].primitives[primitive_id], model);
+    });
+
+    // Load images, which hold the encoded image data until they're decoded here
+    std::vector<ImageDecodeJob> decode_jobs;
     for (const auto &img : model.images) {
-        if (img.component != 4) {
-            std::cout << "WILL: Check non-4 component image support\n";
-        }
-        if (img.pixel_type != TINYGLTF_COMPONENT_TYPE_UNSIGNED_BYTE) {
-            std::cout << "Non-uchar images are not supported\n";
-            throw std::runtime_error("Unsupported image pixel type");
-        }
+        ImageDecodeJob job;
+        job.image_id = textures.size();
+        job.encoded = img.image.data();
+        job.encoded_size = img.image.size();
+        job.flip_y = false;
+        decode_jobs.push_back(job);
 
         Image texture;
         texture.name = img.name;
-        texture.width = img.width;
-        texture.height = img.height;
-        texture.channels = img.component;
-        texture.img = img.image;
         // Assume linear unless we find it used as a color texture
         texture.color_space = LINEAR;
         textures.push_back(texture);
     }
+    decode_images(decode_jobs, textures);
 
     // Load materials
     for (const auto &m : model.materials) {
@@ -400,12 +1067,38 @@ void Scene::load_gltf(const std::string &fname)
     lights.push_back(light);
 }
 
-void Scene::load_crts(const std::string &file)
+/* Reference the count elements at data in the owner's buffer if they're aligned and far
+ * enough from the end of the buffer to meet AttributeBuffer's padding requirement,
+ * otherwise copy them
+ */
+template <typename T>
+static AttributeBuffer<T> make_attribute_buffer(const uint8_t *data,
+                                                const size_t count,
+                                                const uint8_t *buffer_end,
+                                                const std::shared_ptr<const void> &owner)
+{
+    const T *begin = reinterpret_cast<const T *>(data);
+    if (reinterpret_cast<uintptr_t>(data) % alignof(T) == 0 &&
+        size_t(buffer_end - data) >= count * sizeof(T) + 16) {
+        return AttributeBuffer<T>(begin, count, owner);
+    }
+    return std::vector<T>(begin, begin + count);
+}
+
+template <typename T>
+static AttributeBuffer<T> crts_attribute_buffer(const Accessor<T> &accessor,
+                                                const std::shared_ptr<FileMapping> &mapping)
+{
+    return make_attribute_buffer<T>(reinterpret_cast<const uint8_t *>(accessor.begin()),
+                                    accessor.size(),
+                                    mapping->data() + mapping->nbytes(),
+                                    mapping);
+}
+
+void Scene::load_crts_v1(const std::shared_ptr<FileMapping> &mapping)
 {
     using json = nlohmann::json;
-    std::cout << "Loading CRTS " << file << "\n";
 
-    auto mapping = std::make_shared<FileMapping>(file);
     const uint64_t json_header_size = *reinterpret_cast<const uint64_t *>(mapping->data());
     const uint64_t total_header_size = json_header_size + sizeof(uint64_t);
     json header =
@@ -425,18 +1118,33 @@ void Scene::load_crts(const std::string &file)
             BufferView view(data_base + v["byte_offset"].get<uint64_t>(),
                             v["byte_length"].get<uint64_t>(),
                             dtype_stride(dtype));
-            Accessor<glm::vec3> accessor(view);
-            geom.vertices = std::vector<glm::vec3>(accessor.begin(), accessor.end());
+            geom.vertices = crts_attribute_buffer(Accessor<glm::vec3>(view), mapping);
         }
-        {
+        // Grid meshes can be marked explicitly with their [width, height], in which case the
+        // indices are optional
+        if (m.find("grid") != m.end()) {
+            const auto grid_dims = m["grid"].get<std::vector<uint32_t>>();
+            if (grid_dims.size() != 2 || grid_dims[0] < 2 || grid_dims[1] < 2) {
+                throw std::runtime_error(
+                    "CRTS grid meshes must have a [width, height] of at least 2x2");
+            }
+            geom.grid_dims = glm::uvec2(grid_dims[0], grid_dims[1]);
+            if (size_t(geom.grid_dims.x) * geom.grid_dims.y != geom.vertices.size()) {
+                throw std::runtime_error("CRTS grid mesh dimensions do not match vertex count");
+            }
+        }
+        if (m.find("indices") != m.end()) {
             const uint64_t view_id = m["indices"].get<uint64_t>();
             auto &v = header["buffer_views"][view_id];
             const DTYPE dtype = parse_dtype(v["type"]);
             BufferView view(data_base + v["byte_offset"].get<uint64_t>(),
                             v["byte_length"].get<uint64_t>(),
                             dtype_stride(dtype));
-            Accessor<glm::uvec3> accessor(view);
-            geom.indices = std::vector<glm::uvec3>(accessor.begin(), accessor.end());
+            geom.indices = crts_attribute_buffer(Accessor<glm::uvec3>(view), mapping);
+        } else if (geom.is_grid()) {
+            geom.indices = make_grid_indices(geom.grid_dims);
+        } else {
+            throw std::runtime_error("CRTS mesh is missing indices");
         }
         if (m.find("texcoords") != m.end()) {
             const uint64_t view_id = m["texcoords"].get<uint64_t>();
@@ -445,8 +1153,7 @@ void Scene::load_crts(const std::string &file)
             BufferView view(data_base + v["byte_offset"].get<uint64_t>(),
                             v["byte_length"].get<uint64_t>(),
                             dtype_stride(dtype));
-            Accessor<glm::vec2> accessor(view);
-            geom.uvs = std::vector<glm::vec2>(accessor.begin(), accessor.end());
+            geom.uvs = crts_attribute_buffer(Accessor<glm::vec2>(view), mapping);
         }
 #if 0
         if (m.find("normals") != m.end()) {
@@ -456,8 +1163,7 @@ void Scene::load_crts(const std::string &file)
             BufferView view(data_base + v["byte_offset"].get<uint64_t>(),
                             v["byte_length"].get<uint64_t>(),
                             dtype_stride(dtype));
-            Accessor<glm::vec3> accessor(view);
-            geom.normals = std::vector<glm::vec3>(accessor.begin(), accessor.end());
+            geom.normals = crts_attribute_buffer(Accessor<glm::vec3>(view), mapping);
         }
 #endif
 
@@ -466,6 +1172,7 @@ void Scene::load_crts(const std::string &file)
         meshes.push_back(mesh);
     }
 
+    std::vector<ImageDecodeJob> decode_jobs;
     for (size_t i = 0; i < header["images"].size(); ++i) {
         auto &img = header["images"][i];
 
@@ -477,24 +1184,22 @@ void Scene::load_crts(const std::string &file)
                         dtype_stride(dtype));
         Accessor<uint8_t> accessor(view);
 
-        stbi_set_flip_vertically_on_load(1);
-        int x, y, n;
-        uint8_t *img_data =
-            stbi_load_from_memory(accessor.begin(), accessor.size(), &x, &y, &n, 4);
-        stbi_set_flip_vertically_on_load(0);
-        if (!img_data) {
-            std::cout << "Failed to load " << img["name"].get<std::string>() << " from view\n";
-            throw std::runtime_error("Failed to load " + img["name"].get<std::string>());
-        }
+        // The images are decoded in parallel from the file mapping after they're all listed
+        ImageDecodeJob job;
+        job.image_id = textures.size();
+        job.encoded = accessor.begin();
+        job.encoded_size = accessor.size();
+        decode_jobs.push_back(job);
 
-        ColorSpace color_space = SRGB;
+        Image texture;
+        texture.name = img["name"].get<std::string>();
+        texture.color_space = SRGB;
         if (img["color_space"].get<std::string>() == "LINEAR") {
-            color_space = LINEAR;
+            texture.color_space = LINEAR;
         }
-
-        textures.emplace_back(img_data, x, y, 4, img["name"].get<std::string>(), color_space);
-        stbi_image_free(img_data);
+        textures.push_back(texture);
     }
+    decode_images(decode_jobs, textures);
 
     for (size_t i = 0; i < header["materials"].size(); ++i) {
         auto &m = header["materials"][i];
@@ -586,6 +1291,268 @@ void Scene::load_crts(const std::string &file)
             throw std::runtime_error("Unsupported object type: not a mesh or camera?");
         }
     }
+}
+
+/* A CRTS v2 buffer view in the file mapping, or in the decompressed buffer owning it. Both
+ * are padded after the view's data, as AttributeBuffer requires
+ */
+struct CRTSResolvedView {
+    const uint8_t *data = nullptr;
+    uint64_t size = 0;
+    const uint8_t *buffer_end = nullptr;
+    std::shared_ptr<const void> owner;
+};
+
+template <typename T>
+static AttributeBuffer<T> crts_view_attribute(const CRTSResolvedView &view)
+{
+    if (view.size % sizeof(T) != 0) {
+        throw std::runtime_error("CRTS v2 buffer view size is not a multiple of its type");
+    }
+    return make_attribute_buffer<T>(
+        view.data, view.size / sizeof(T), view.buffer_end, view.owner);
+}
+
+// Get the CRTS v2 table, checking it's within the file
+template <typename T>
+static const T *crts_table(const FileMapping &mapping, const CRTSTable &table)
+{
+    if (table.offset % alignof(T) != 0 || table.offset > mapping.nbytes() ||
+        table.count > (mapping.nbytes() - table.offset) / sizeof(T)) {
+        throw std::runtime_error("CRTS v2 table is out of bounds");
+    }
+    return reinterpret_cast<const T *>(mapping.data() + table.offset);
+}
+
+void Scene::load_crts_v2(const std::shared_ptr<FileMapping> &mapping)
+{
+    static_assert(sizeof(DisneyMaterial) == 64, "CRTS v2 stores materials as DisneyMaterial");
+    static_assert(sizeof(QuadLight) == 80, "CRTS v2 stores lights as QuadLight");
+    static_assert(sizeof(Camera) == 40, "CRTS v2 stores cameras as Camera");
+
+    CRTSHeader header;
+    std::memcpy(&header, mapping->data(), sizeof(CRTSHeader));
+    if (header.version != CRTS_V2_VERSION) {
+        throw std::runtime_error("Unsupported CRTS version " + std::to_string(header.version));
+    }
+    const auto *views = crts_table<CRTSBufferView>(*mapping, header.views);
+    const auto *crts_geometries = crts_table<CRTSGeometry>(*mapping, header.geometries);
+    const auto *crts_meshes = crts_table<CRTSMesh>(*mapping, header.meshes);
+    const auto *crts_param_meshes =
+        crts_table<CRTSParameterizedMesh>(*mapping, header.parameterized_meshes);
+    const auto *material_ids = crts_table<uint32_t>(*mapping, header.material_ids);
+    const auto *crts_instances = crts_table<CRTSInstance>(*mapping, header.instances);
+    const auto *crts_groups = crts_table<CRTSInstanceGroup>(*mapping, header.instance_groups);
+    const auto *crts_group_instances =
+        crts_table<CRTSInstance>(*mapping, header.group_instances);
+    const auto *crts_materials = crts_table<DisneyMaterial>(*mapping, header.materials);
+    const auto *images = crts_table<CRTSImage>(*mapping, header.images);
+    const auto *crts_lights = crts_table<QuadLight>(*mapping, header.lights);
+    const auto *crts_cameras = crts_table<Camera>(*mapping, header.cameras);
+    const auto *strings = crts_table<char>(*mapping, header.strings);
+
+    // Decompress the compressed buffer views in parallel, with the same padding as the file
+    std::vector<CRTSResolvedView> resolved_views(header.views.count);
+    parallel_for(0, header.views.count, [&](const size_t i) {
+        const CRTSBufferView &v = views[i];
+        if (v.offset > mapping->nbytes() || v.size > mapping->nbytes() - v.offset) {
+            throw std::runtime_error("CRTS v2 buffer view is out of bounds");
+        }
+        CRTSResolvedView &view = resolved_views[i];
+        if (v.compression == CRTS_COMPRESSION_NONE) {
+            view.data = mapping->data() + v.offset;
+            view.size = v.size;
+            view.buffer_end = mapping->data() + mapping->nbytes();
+            view.owner = mapping;
+        } else {
+            auto buf = std::make_shared<std::vector<uint8_t>>(v.uncompressed_size + 16);
+            crts_decompress(v.compression,
+                            mapping->data() + v.offset,
+                            v.size,
+                            buf->data(),
+                            v.uncompressed_size);
+            view.data = buf->data();
+            view.size = v.uncompressed_size;
+            view.buffer_end = buf->data() + buf->size();
+            view.owner = buf;
+        }
+    });
+    auto get_view = [&](const uint32_t id) -> const CRTSResolvedView & {
+        if (id >= resolved_views.size()) {
+            throw std::runtime_error("Invalid CRTS v2 buffer view " + std::to_string(id));
+        }
+        return resolved_views[id];
+    };
+    auto check_range = [](const uint64_t first, const uint64_t count, const uint64_t size) {
+        if (first > size || count > size - first) {
+            throw std::runtime_error("CRTS v2 table range is out of bounds");
+        }
+    };
+
+    std::vector<Geometry> geometries(header.geometries.count);
+    for (size_t i = 0; i < geometries.size(); ++i) {
+        const CRTSGeometry &g = crts_geometries[i];
+        Geometry &geom = geometries[i];
+        geom.vertices = crts_view_attribute<glm::vec3>(get_view(g.positions_view));
+        geom.grid_dims = glm::uvec2(g.grid_dims[0], g.grid_dims[1]);
+        if ((geom.grid_dims.x != 0 || geom.grid_dims.y != 0) &&
+            (geom.grid_dims.x < 2 || geom.grid_dims.y < 2)) {
+            throw std::runtime_error("CRTS grid meshes must be at least 2x2");
+        }
+        if (geom.is_grid() &&
+            size_t(geom.grid_dims.x) * geom.grid_dims.y != geom.vertices.size()) {
+            throw std::runtime_error("CRTS grid mesh dimensions do not match vertex count");
+        }
+        if (g.indices_view != CRTS_NO_VIEW) {
+            geom.indices = crts_view_attribute<glm::uvec3>(get_view(g.indices_view));
+        } else if (geom.is_grid()) {
+            geom.indices = make_grid_indices(geom.grid_dims);
+        } else {
+            throw std::runtime_error("CRTS mesh is missing indices");
+        }
+        if (g.texcoords_view != CRTS_NO_VIEW) {
+            geom.uvs = crts_view_attribute<glm::vec2>(get_view(g.texcoords_view));
+        }
+        if (g.normals_view != CRTS_NO_VIEW) {
+            geom.normals = crts_view_attribute<glm::vec3>(get_view(g.normals_view));
+        }
+    }
+    // The backends index the vertex attributes without bounds checks, so the indices and
+    // attribute counts are validated here, in parallel since the geometry can be large
+    parallel_for(0, geometries.size(), [&](const size_t i) {
+        const Geometry &geom = geometries[i];
+        const size_t num_verts = geom.vertices.size();
+        if ((!geom.normals.empty() && geom.normals.size() != num_verts) ||
+            (!geom.uvs.empty() && geom.uvs.size() != num_verts)) {
+            throw std::runtime_error("CRTS geometry attribute counts do not match");
+        }
+        for (const auto &tri : geom.indices) {
+            if (tri.x >= num_verts || tri.y >= num_verts || tri.z >= num_verts) {
+                throw std::runtime_error("CRTS geometry indices are out of bounds");
+            }
+        }
+    });
+
+    const size_t mesh_offset = meshes.size();
+    for (size_t i = 0; i < header.meshes.count; ++i) {
+        const CRTSMesh &m = crts_meshes[i];
+        check_range(m.first_geometry, m.num_geometries, geometries.size());
+        meshes.emplace_back(std::vector<Geometry>(
+            geometries.begin() + m.first_geometry,
+            geometries.begin() + m.first_geometry + m.num_geometries));
+    }
+
+    const size_t param_mesh_offset = parameterized_meshes.size();
+    for (size_t i = 0; i < header.parameterized_meshes.count; ++i) {
+        const CRTSParameterizedMesh &pm = crts_param_meshes[i];
+        if (pm.mesh >= header.meshes.count) {
+            throw std::runtime_error("Invalid CRTS mesh " + std::to_string(pm.mesh));
+        }
+        const size_t num_geometries = crts_meshes[pm.mesh].num_geometries;
+        check_range(pm.first_material_id, num_geometries, header.material_ids.count);
+        parameterized_meshes.emplace_back(
+            mesh_offset + pm.mesh,
+            std::vector<uint32_t>(material_ids + pm.first_material_id,
+                                  material_ids + pm.first_material_id + num_geometries));
+    }
+
+    auto read_instances = [&](const uint64_t first, const uint64_t count) {
+        check_range(first, count, header.instances.count);
+        std::vector<Instance> insts;
+        insts.reserve(count);
+        for (size_t i = first; i < first + count; ++i) {
+            const CRTSInstance &inst = crts_instances[i];
+            if (inst.id >= header.parameterized_meshes.count) {
+                throw std::runtime_error("Invalid CRTS parameterized mesh " +
+                                         std::to_string(inst.id));
+            }
+            insts.emplace_back(glm::make_mat4(inst.transform), param_mesh_offset + inst.id);
+        }
+        return insts;
+    };
+    auto read_group_instances = [&](const uint64_t first, const uint64_t count) {
+        check_range(first, count, header.group_instances.count);
+        std::vector<GroupInstance> insts;
+        insts.reserve(count);
+        for (size_t i = first; i < first + count; ++i) {
+            const CRTSInstance &inst = crts_group_instances[i];
+            if (inst.id >= header.instance_groups.count) {
+                throw std::runtime_error("Invalid CRTS instance group " +
+                                         std::to_string(inst.id));
+            }
+            insts.emplace_back(glm::make_mat4(inst.transform),
+                               instance_groups.size() + inst.id);
+        }
+        return insts;
+    };
+    std::vector<Instance> top_level_instances =
+        read_instances(0, header.num_top_level_instances);
+    std::vector<GroupInstance> top_level_group_instances =
+        read_group_instances(0, header.num_top_level_group_instances);
+    std::vector<InstanceGroup> groups(header.instance_groups.count);
+    for (size_t i = 0; i < groups.size(); ++i) {
+        const CRTSInstanceGroup &g = crts_groups[i];
+        groups[i].instances = read_instances(g.first_instance, g.num_instances);
+        groups[i].group_instances =
+            read_group_instances(g.first_group_instance, g.num_group_instances);
+    }
+    instances.insert(instances.end(), top_level_instances.begin(), top_level_instances.end());
+    group_instances.insert(group_instances.end(),
+                           top_level_group_instances.begin(),
+                           top_level_group_instances.end());
+    instance_groups.insert(instance_groups.end(), groups.begin(), groups.end());
+
+    // Pre-decoded images are copied directly, encoded ones are decoded in parallel
+    std::vector<ImageDecodeJob> decode_jobs;
+    for (size_t i = 0; i < header.images.count; ++i) {
+        const CRTSImage &img = images[i];
+        const CRTSResolvedView &view = get_view(img.view);
+        check_range(img.name_offset, img.name_size, header.strings.count);
+
+        Image texture;
+        texture.name = std::string(strings + img.name_offset, img.name_size);
+        texture.color_space = img.color_space == SRGB ? SRGB : LINEAR;
+        if (img.format == CRTS_IMAGE_ENCODED) {
+            ImageDecodeJob job;
+            job.image_id = textures.size();
+            job.encoded = view.data;
+            job.encoded_size = view.size;
+            decode_jobs.push_back(job);
+        } else if (img.format == CRTS_IMAGE_RGBA8) {
+            if (uint64_t(img.width) * img.height * 4 != view.size) {
+                throw std::runtime_error("CRTS image " + texture.name +
+                                         " size does not match its dimensions");
+            }
+            texture.width = img.width;
+            texture.height = img.height;
+            texture.channels = 4;
+            texture.img = std::vector<uint8_t>(view.data, view.data + view.size);
+        } else {
+            throw std::runtime_error("Unsupported CRTS image format " +
+                                     std::to_string(img.format));
+        }
+        textures.push_back(texture);
+    }
+    decode_images(decode_jobs, textures);
+
+    materials.insert(
+        materials.end(), crts_materials, crts_materials + header.materials.count);
+    lights.insert(lights.end(), crts_lights, crts_lights + header.lights.count);
+    cameras.insert(cameras.end(), crts_cameras, crts_cameras + header.cameras.count);
+}
+
+void Scene::load_crts(const std::string &file)
+{
+    std::cout << "Loading CRTS " << file << "\n";
+
+    auto mapping = std::make_shared<FileMapping>(file);
+    // CRTS v1 files start with the size of their JSON header, which can't match the v2 magic
+    if (mapping->nbytes() >= sizeof(CRTSHeader) &&
+        std::memcmp(mapping->data(), CRTS_V2_MAGIC, sizeof(CRTS_V2_MAGIC)) == 0) {
+        load_crts_v2(mapping);
+    } else {
+        load_crts_v1(mapping);
+    }
 
     validate_materials();
 
@@ -606,6 +1573,29 @@ void Scene::load_crts(const std::string &file)
 
 #ifdef PBRT_PARSER_ENABLED
 
+// Get the diffuse color of the PBRT materials which can have a diffuse texture
+static glm::vec3 pbrt_diffuse_color(const pbrt::Material::SP &mat)
+{
+    if (auto m = std::dynamic_pointer_cast<pbrt::PlasticMaterial>(mat)) {
+        return glm::vec3(m->kd.x, m->kd.y, m->kd.z);
+    } else if (auto m = std::dynamic_pointer_cast<pbrt::MatteMaterial>(mat)) {
+        return glm::vec3(m->kd.x, m->kd.y, m->kd.z);
+    } else if (auto m = std::dynamic_pointer_cast<pbrt::SubstrateMaterial>(mat)) {
+        return glm::vec3(m->kd.x, m->kd.y, m->kd.z);
+    }
+    return DisneyMaterial().base_color;
+}
+
+static glm::mat4 pbrt_affine_to_mat4(const pbrt::affine3f &xfm)
+{
+    glm::mat4 transform(1.f);
+    transform[0] = glm::vec4(xfm.l.vx.x, xfm.l.vx.y, xfm.l.vx.z, 0.f);
+    transform[1] = glm::vec4(xfm.l.vy.x, xfm.l.vy.y, xfm.l.vy.z, 0.f);
+    transform[2] = glm::vec4(xfm.l.vz.x, xfm.l.vz.y, xfm.l.vz.z, 0.f);
+    transform[3] = glm::vec4(xfm.p.x, xfm.p.y, xfm.p.z, 1.f);
+    return transform;
+}
+
 void Scene::load_pbrt(const std::string &file)
 {
     std::shared_ptr<pbrt::Scene> scene = nullptr;
@@ -620,7 +1610,6 @@ void Scene::load_pbrt(const std::string &file)
             throw std::runtime_error("Failed to load PBRT scene from " + file);
         }
 
-        scene->makeSingleLevel();
     } catch (const std::runtime_error &e) {
         std::cout << "Error loading PBRT scene " << file << "\n";
         throw e;
@@ -628,137 +1617,56 @@ void Scene::load_pbrt(const std::string &file)
 
     const std::string pbrt_base_dir = file.substr(0, file.rfind('/'));
 
-    // TODO: The world can also have some top-level things we may need to load. But is this
-    // common? Or does Ingo's make single level flatten these down to a shape?
-    for (const auto &obj : scene->world->shapes) {
-        if (obj->material) {
-            std::cout << "Top level Mat: " << obj->material->toString() << "\n";
-        }
-
-        // What would these top-level textures be used for?
-        if (!obj->textures.empty()) {
-            std::cout << "top level textures " << obj->textures.size() << "\n";
-            for (const auto &t : obj->textures) {
-                auto img_tex = std::dynamic_pointer_cast<pbrt::ImageTexture>(t.second);
-                if (img_tex) {
-                    std::cout << "Image texture: " << t.first << " from file "
-                              << img_tex->fileName << "\n";
-                } else {
-                    std::cout << "Unsupported non-image texture used by texture '" << t.first
-                              << "'\n";
-                }
-            }
-        }
-
-        if (obj->areaLight) {
-            std::cout << "Encountered area light\n";
-        }
-
-        if (pbrt::TriangleMesh::SP mesh = std::dynamic_pointer_cast<pbrt::TriangleMesh>(obj)) {
-            std::cout << "Found root level triangle mesh w/ " << mesh->index.size()
-                      << " triangles: " << mesh->toString() << "\n";
-        } else if (pbrt::QuadMesh::SP mesh = std::dynamic_pointer_cast<pbrt::QuadMesh>(obj)) {
-            std::cout << "Encountered root level quadmesh (unsupported type). Will TODO maybe "
-                         "triangulate\n";
-        } else {
-            std::cout << "un-handled root level geometry type : " << obj->toString()
-                      << std::endl;
-        }
-    }
-
-    // For PBRTv3 Each Mesh corresponds to a PBRT Object, consisting of potentially
-    // multiple Shapes. This maps to a Mesh with multiple geometries, which can then be
-    // instanced
+    // For PBRTv3 each Object corresponds to a Mesh with a geometry for each of its Shapes,
+    // which can then be instanced. Objects which also instance other objects are loaded as
+    // instance groups to keep the instancing hierarchy. The world is loaded as the root
+    // object, so its shapes become a mesh placed at the origin alongside its instances
     phmap::parallel_flat_hash_map<pbrt::Material::SP, size_t> pbrt_materials;
     phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> pbrt_textures;
-    phmap::parallel_flat_hash_map<std::string, size_t> pbrt_objects;
-    for (const auto &inst : scene->world->instances) {
-        // Check if this object has already been loaded for the instance
-        // PBRT geometries are also parameterized with a material, similar to GLTF
-        auto fnd = pbrt_objects.find(inst->object->name);
-        size_t parameterized_mesh_id = -1;
-        if (fnd == pbrt_objects.end()) {
-            std::cout << "Loading newly encountered instanced object " << inst->object->name
-                      << "\n";
+    phmap::parallel_flat_hash_map<pbrt::Object::SP, PBRTObject> pbrt_objects;
+    std::vector<ImageDecodeJob> decode_jobs;
+    const PBRTObject world = load_pbrt_object(scene->world,
+                                              pbrt_base_dir,
+                                              pbrt_objects,
+                                              pbrt_materials,
+                                              pbrt_textures,
+                                              decode_jobs);
+    if (world.group_id != size_t(-1)) {
+        // The world's group is loaded last and can't be instanced by other objects, so its
+        // contents are placed at the top level instead of adding an identity instance level
+        const InstanceGroup world_group = instance_groups[world.group_id];
+        instance_groups.pop_back();
+        instances.insert(
+            instances.end(), world_group.instances.begin(), world_group.instances.end());
+        group_instances.insert(group_instances.end(),
+                               world_group.group_instances.begin(),
+                               world_group.group_instances.end());
+    } else if (world.parameterized_mesh_id != size_t(-1)) {
+        instances.emplace_back(glm::mat4(1.f), world.parameterized_mesh_id);
+    }
 
-            std::vector<uint32_t> material_ids;
-            std::vector<Geometry> geometries;
-            for (const auto &g : inst->object->shapes) {
-                if (pbrt::TriangleMesh::SP mesh =
-                        std::dynamic_pointer_cast<pbrt::TriangleMesh>(g)) {
-                    std::cout << "Object triangle mesh w/ " << mesh->index.size()
-                              << " triangles: " << mesh->toString() << "\n";
-
-                    uint32_t material_id = -1;
-                    if (mesh->material) {
-                        material_id = load_pbrt_materials(mesh->material,
-                                                          mesh->textures,
-                                                          pbrt_base_dir,
-                                                          pbrt_materials,
-                                                          pbrt_textures);
-                    }
-                    material_ids.push_back(material_id);
-
-                    Geometry geom;
-                    geom.vertices.reserve(mesh->vertex.size());
-                    std::transform(
-                        mesh->vertex.begin(),
-                        mesh->vertex.end(),
-                        std::back_inserter(geom.vertices),
-                        [](const pbrt::vec3f &v) { return glm::vec3(v.x, v.y, v.z); });
-
-                    geom.indices.reserve(mesh->index.size());
-                    std::transform(
-                        mesh->index.begin(),
-                        mesh->index.end(),
-                        std::back_inserter(geom.indices),
-                        [](const pbrt::vec3i &v) { return glm::ivec3(v.x, v.y, v.z); });
-
-                    geom.uvs.reserve(mesh->texcoord.size());
-                    std::transform(mesh->texcoord.begin(),
-                                   mesh->texcoord.end(),
-                                   std::back_inserter(geom.uvs),
-                                   [](const pbrt::vec2f &v) { return glm::vec2(v.x, v.y); });
-
-                    geometries.push_back(geom);
-                } else if (pbrt::QuadMesh::SP mesh =
-                               std::dynamic_pointer_cast<pbrt::QuadMesh>(g)) {
-                    std::cout << "Encountered instanced quadmesh (unsupported type). Will "
-                                 "TODO maybe triangulate\n";
-                } else {
-                    std::cout << "un-handled instanced geometry type : " << g->toString()
-                              << std::endl;
-                }
-            }
-            if (inst->object->instances.size() > 0) {
-                std::cout
-                    << "Warning: Potentially multilevel instancing is in the scene after "
-                       "flattening?\n";
-            }
-            // Mesh only contains unsupported objects, skip it
-            if (geometries.empty()) {
-                std::cout << "WARNING: Instance contains only unsupported geometries, "
-                             "skipping\n";
-                continue;
+    // Only the texture headers were checked while parsing, so textures which fail to decode
+    // are replaced by a placeholder and their materials fall back to the untextured color,
+    // as for unsupported textures
+    const std::vector<size_t> failed_textures = try_decode_images(decode_jobs, textures);
+    for (const size_t id : failed_textures) {
+        std::cout << "Failed to decode texture " << textures[id].name
+                  << ", using the untextured material\n";
+        const uint8_t white[4] = {255, 255, 255, 255};
+        textures[id] = Image(white, 1, 1, 4, textures[id].name, textures[id].color_space);
+    }
+    if (!failed_textures.empty()) {
+        for (const auto &m : pbrt_materials) {
+            DisneyMaterial &mat = materials[m.second];
+            uint32_t handle = 0;
+            std::memcpy(&handle, &mat.base_color.r, sizeof(float));
+            if (IS_TEXTURED_PARAM(handle) &&
+                std::find(failed_textures.begin(),
+                          failed_textures.end(),
+                          GET_TEXTURE_ID(handle)) != failed_textures.end()) {
+                mat.base_color.r = pbrt_diffuse_color(m.first).r;
             }
-            const size_t mesh_id = meshes.size();
-            meshes.emplace_back(geometries);
-
-            parameterized_mesh_id = parameterized_meshes.size();
-            parameterized_meshes.emplace_back(mesh_id, material_ids);
-
-            pbrt_objects[inst->object->name] = parameterized_mesh_id;
-        } else {
-            parameterized_mesh_id = fnd->second;
         }
-
-        glm::mat4 transform(1.f);
-        transform[0] = glm::vec4(inst->xfm.l.vx.x, inst->xfm.l.vx.y, inst->xfm.l.vx.z, 0.f);
-        transform[1] = glm::vec4(inst->xfm.l.vy.x, inst->xfm.l.vy.y, inst->xfm.l.vy.z, 0.f);
-        transform[2] = glm::vec4(inst->xfm.l.vz.x, inst->xfm.l.vz.y, inst->xfm.l.vz.z, 0.f);
-        transform[3] = glm::vec4(inst->xfm.p.x, inst->xfm.p.y, inst->xfm.p.z, 1.f);
-
-        instances.emplace_back(transform, parameterized_mesh_id);
     }
 
     validate_materials();
@@ -774,12 +1682,120 @@ void Scene::load_pbrt(const std::string &file)
     lights.push_back(light);
 }
 
+Scene::PBRTObject Scene::load_pbrt_object(
+    const pbrt::Object::SP &object,
+    const std::string &pbrt_base_dir,
+    phmap::parallel_flat_hash_map<pbrt::Object::SP, PBRTObject> &pbrt_objects,
+    phmap::parallel_flat_hash_map<pbrt::Material::SP, size_t> &pbrt_materials,
+    phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> &pbrt_textures,
+    std::vector<ImageDecodeJob> &decode_jobs)
+{
+    auto fnd = pbrt_objects.find(object);
+    if (fnd != pbrt_objects.end()) {
+        return fnd->second;
+    }
+    std::cout << "Loading newly encountered instanced object " << object->name << "\n";
+
+    PBRTObject loaded;
+    std::vector<uint32_t> material_ids;
+    std::vector<Geometry> geometries;
+    for (const auto &g : object->shapes) {
+        if (pbrt::TriangleMesh::SP mesh =
+                std::dynamic_pointer_cast<pbrt::TriangleMesh>(g)) {
+            std::cout << "Object triangle mesh w/ " << mesh->index.size()
+                      << " triangles: " << mesh->toString() << "\n";
+
+            uint32_t material_id = -1;
+            if (mesh->material) {
+                material_id = load_pbrt_materials(mesh->material,
+                                                  mesh->textures,
+                                                  pbrt_base_dir,
+                                                  pbrt_materials,
+                                                  pbrt_textures,
+                                                  decode_jobs);
+            }
+            material_ids.push_back(material_id);
+
+            Geometry geom;
+            geom.vertices.reserve(mesh->vertex.size());
+            std::transform(
+                mesh->vertex.begin(),
+                mesh->vertex.end(),
+                std::back_inserter(geom.vertices),
+                [](const pbrt::vec3f &v) { return glm::vec3(v.x, v.y, v.z); });
+
+            geom.indices.reserve(mesh->index.size());
+            std::transform(
+                mesh->index.begin(),
+                mesh->index.end(),
+                std::back_inserter(geom.indices),
+                [](const pbrt::vec3i &v) { return glm::ivec3(v.x, v.y, v.z); });
+
+            geom.uvs.reserve(mesh->texcoord.size());
+            std::transform(mesh->texcoord.begin(),
+                           mesh->texcoord.end(),
+                           std::back_inserter(geom.uvs),
+                           [](const pbrt::vec2f &v) { return glm::vec2(v.x, v.y); });
+
+            geometries.push_back(geom);
+        } else if (pbrt::QuadMesh::SP mesh =
+                       std::dynamic_pointer_cast<pbrt::QuadMesh>(g)) {
+            std::cout << "Encountered instanced quadmesh (unsupported type). Will "
+                         "TODO maybe triangulate\n";
+        } else {
+            std::cout << "un-handled instanced geometry type : " << g->toString()
+                      << std::endl;
+        }
+    }
+    if (!geometries.empty()) {
+        const size_t mesh_id = meshes.size();
+        meshes.emplace_back(geometries);
+
+        loaded.parameterized_mesh_id = parameterized_meshes.size();
+        parameterized_meshes.emplace_back(mesh_id, material_ids);
+    }
+
+    if (!object->instances.empty()) {
+        InstanceGroup group;
+        if (loaded.parameterized_mesh_id != size_t(-1)) {
+            group.instances.emplace_back(glm::mat4(1.f), loaded.parameterized_mesh_id);
+        }
+        for (const auto &inst : object->instances) {
+            const PBRTObject child = load_pbrt_object(inst->object,
+                                                      pbrt_base_dir,
+                                                      pbrt_objects,
+                                                      pbrt_materials,
+                                                      pbrt_textures,
+                                                      decode_jobs);
+            if (child.group_id != size_t(-1)) {
+                group.group_instances.emplace_back(pbrt_affine_to_mat4(inst->xfm),
+                                                   child.group_id);
+            } else if (child.parameterized_mesh_id != size_t(-1)) {
+                group.instances.emplace_back(pbrt_affine_to_mat4(inst->xfm),
+                                             child.parameterized_mesh_id);
+            }
+        }
+        if (!group.instances.empty() || !group.group_instances.empty()) {
+            loaded.group_id = instance_groups.size();
+            instance_groups.push_back(group);
+        }
+    }
+
+    // Object only contains unsupported objects, skip it
+    if (loaded.parameterized_mesh_id == size_t(-1) && loaded.group_id == size_t(-1)) {
+        std::cout << "WARNING: Object contains only unsupported geometries, skipping\n";
+    }
+    pbrt_objects[object] = loaded;
+    return loaded;
+}
+
 uint32_t Scene::load_pbrt_materials(
     const pbrt::Material::SP &mat,
     const std::map<std::string, pbrt::Texture::SP> &texture_overrides,
     const std::string &pbrt_base_dir,
     phmap::parallel_flat_hash_map<pbrt::Material::SP, size_t> &pbrt_materials,
-    phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> &pbrt_textures)
+    phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> &pbrt_textures,
+    std::vector<ImageDecodeJob> &decode_jobs)
 {
     auto fnd = pbrt_materials.find(mat);
     if (fnd != pbrt_materials.end()) {
@@ -818,7 +1834,7 @@ uint32_t Scene::load_pbrt_materials(
                     glm::vec3(const_tex->value.x, const_tex->value.y, const_tex->value.z);
             } else {
                 const uint32_t tex_id =
-                    load_pbrt_texture(m->map_kd, pbrt_base_dir, pbrt_textures);
+                    load_pbrt_texture(m->map_kd, pbrt_base_dir, pbrt_textures, decode_jobs);
                 if (tex_id != uint32_t(-1)) {
                     uint32_t tex_mask = TEXTURED_PARAM_MASK;
                     SET_TEXTURE_ID(tex_mask, tex_id);
@@ -838,7 +1854,7 @@ uint32_t Scene::load_pbrt_materials(
                     glm::vec3(const_tex->value.x, const_tex->value.y, const_tex->value.z);
             } else {
                 const uint32_t tex_id =
-                    load_pbrt_texture(m->map_kd, pbrt_base_dir, pbrt_textures);
+                    load_pbrt_texture(m->map_kd, pbrt_base_dir, pbrt_textures, decode_jobs);
                 if (tex_id != uint32_t(-1)) {
                     uint32_t tex_mask = TEXTURED_PARAM_MASK;
                     SET_TEXTURE_ID(tex_mask, tex_id);
@@ -854,7 +1870,7 @@ uint32_t Scene::load_pbrt_materials(
                     glm::vec3(const_tex->value.x, const_tex->value.y, const_tex->value.z);
             } else {
                 const uint32_t tex_id =
-                    load_pbrt_texture(m->map_kd, pbrt_base_dir, pbrt_textures);
+                    load_pbrt_texture(m->map_kd, pbrt_base_dir, pbrt_textures, decode_jobs);
                 if (tex_id != uint32_t(-1)) {
                     uint32_t tex_mask = TEXTURED_PARAM_MASK;
                     SET_TEXTURE_ID(tex_mask, tex_id);
@@ -883,7 +1899,8 @@ uint32_t Scene::load_pbrt_materials(
 uint32_t Scene::load_pbrt_texture(
     const pbrt::Texture::SP &texture,
     const std::string &pbrt_base_dir,
-    phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> &pbrt_textures)
+    phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> &pbrt_textures,
+    std::vector<ImageDecodeJob> &decode_jobs)
 {
     auto fnd = pbrt_textures.find(texture);
     if (fnd != pbrt_textures.end()) {
@@ -893,18 +1910,27 @@ uint32_t Scene::load_pbrt_texture(
     if (auto t = std::dynamic_pointer_cast<pbrt::ImageTexture>(texture)) {
         std::string path = t->fileName;
         canonicalize_path(path);
-        try {
-            Image img(pbrt_base_dir + "/" + path, t->fileName, SRGB);
-            const uint32_t id = textures.size();
-            pbrt_textures[texture] = id;
-            textures.push_back(img);
-            std::cout << "Loaded image texture: " << t->fileName << "\n";
-            return id;
-        } catch (const std::runtime_error &) {
+        // Only the image header is read here to check the file can be loaded, the image is
+        // decoded with the rest of the scene's textures once the scene is loaded
+        ImageDecodeJob job;
+        job.file = pbrt_base_dir + "/" + path;
+        int x, y, n;
+        if (!stbi_info(job.file.c_str(), &x, &y, &n)) {
             std::cout << "Unsupported file format or failed to load file: " << t->fileName
                       << "\n";
             return -1;
         }
+        const uint32_t id = textures.size();
+        pbrt_textures[texture] = id;
+        job.image_id = id;
+        decode_jobs.push_back(job);
+
+        Image img;
+        img.name = t->fileName;
+        img.color_space = SRGB;
+        textures.push_back(img);
+        std::cout << "Found image texture: " << t->fileName << "\n";
+        return id;
     }
 
     std::cout << "Texture type " << texture->toString() << " is not supported\n";
@@ -13,16 +13,24 @@
 #include "pbrtParser/Scene.h"
 #endif
 
+class FileMapping;
+
 struct Scene {
     std::vector<Mesh> meshes;
     std::vector<ParameterizedMesh> parameterized_meshes;
     std::vector<Instance> instances;
+    std::vector<InstanceGroup> instance_groups;
+    // Top-level instances of instance groups
+    std::vector<GroupInstance> group_instances;
     std::vector<DisneyMaterial> materials;
     std::vector<Image> textures;
     std::vector<QuadLight> lights;
     std::vector<Camera> cameras;
 
-    Scene(const std::string &fname);
+    /* Load the scene file. If a cache directory is given the scene is loaded from its
+     * cache there if one exists, otherwise the loaded scene is saved to the cache
+     */
+    Scene(const std::string &fname, const std::string &cache_dir = "");
     Scene() = default;
 
     // Compute the unique number of triangles in the scene
@@ -33,6 +41,38 @@ struct Scene {
 
     size_t num_geometries() const;
 
+    // Compute the number of instancing levels in the scene, 1 if there are no instance groups
+    size_t instance_levels() const;
+
+    /* Expand the instance groups into top-level instances of the parameterized meshes, for
+     * backends which don't support multi-level instancing
+     */
+    void flatten_instance_groups();
+
+    /* Bake the transforms of meshes instanced at most max_instance_count times into their
+     * geometry and merge them into a few large meshes placed by identity instances. This
+     * removes the two-level traversal and per-instance transform cost for the many singly
+     * instanced objects typical of exported scenes, while meshes instanced more often stay
+     * instanced since baking would duplicate their geometry.
+     */
+    void merge_instances(const size_t max_instance_count);
+
+    /* Collapse byte-identical meshes and textures into a single shared copy, remapping the
+     * parameterized meshes, instances and materials which referenced the duplicates.
+     * Exported scenes often contain the same mesh under different names, or the same image
+     * through different paths, and each copy would otherwise be stored, uploaded and have
+     * its BVH built separately. Repeated meshes become instances of the shared mesh.
+     */
+    void deduplicate();
+
+    /* Weld duplicate vertices and reorder the triangles and vertices of each geometry along
+     * a Morton curve (see geometry_optimize.h), for better BVH build locality and shading
+     * attribute cache hits. Grid geometries are left unchanged. Geometries using the same
+     * buffers still share them after optimization, but buffers shared between geometries
+     * which differ in their other buffers become separate owned copies
+     */
+    void optimize_meshes();
+
 private:
     void load_obj(const std::string &file);
 
@@ -40,20 +80,41 @@ private:
 
     void load_crts(const std::string &file);
 
+    void load_crts_v1(const std::shared_ptr<FileMapping> &mapping);
+
+    void load_crts_v2(const std::shared_ptr<FileMapping> &mapping);
+
 #ifdef PBRT_PARSER_ENABLED
     void load_pbrt(const std::string &file);
 
+    // A PBRT object is loaded as a parameterized mesh of its shapes, and an instance group
+    // if it also instances other objects
+    struct PBRTObject {
+        size_t parameterized_mesh_id = -1;
+        size_t group_id = -1;
+    };
+
+    PBRTObject load_pbrt_object(
+        const pbrt::Object::SP &object,
+        const std::string &pbrt_base_dir,
+        phmap::parallel_flat_hash_map<pbrt::Object::SP, PBRTObject> &pbrt_objects,
+        phmap::parallel_flat_hash_map<pbrt::Material::SP, size_t> &pbrt_materials,
+        phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> &pbrt_textures,
+        std::vector<ImageDecodeJob> &decode_jobs);
+
     uint32_t load_pbrt_materials(
         const pbrt::Material::SP &mat,
         const std::map<std::string, pbrt::Texture::SP> &texture_overrides,
         const std::string &pbrt_base_dir,
         phmap::parallel_flat_hash_map<pbrt::Material::SP, size_t> &pbrt_materials,
-        phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> &pbrt_textures);
+        phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> &pbrt_textures,
+        std::vector<ImageDecodeJob> &decode_jobs);
 
     uint32_t load_pbrt_texture(
         const pbrt::Texture::SP &texture,
         const std::string &pbrt_base_dir,
-        phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> &pbrt_textures);
+        phmap::parallel_flat_hash_map<pbrt::Texture::SP, size_t> &pbrt_textures,
+        std::vector<ImageDecodeJob> &decode_jobs);
 #endif
 
     void validate_materials();
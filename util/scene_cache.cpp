@@ -0,0 +1,401 @@
+#include "scene_cache.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include "file_mapping.h"
+#include "util.h"
+
+// Bump the version when the layout of the cache or the scene data changes
+static const uint32_t SCENE_CACHE_VERSION = 2;
+static const char SCENE_CACHE_MAGIC[8] = {'C', 'R', 'T', 'C', 'A', 'C', 'H', 'E'};
+static const uint64_t SCENE_CACHE_ALIGNMENT = 64;
+
+struct SceneCacheHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t pad;
+    uint64_t content_hash;
+    // The size of the cache file, to catch truncated files
+    uint64_t nbytes;
+};
+
+uint64_t hash_scene_file(const std::string &file)
+{
+    const FileMapping mapping(file);
+    // The file is hashed in blocks in parallel, and the block hashes are then combined in
+    // order to get the same hash for any number of threads
+    const size_t block_size = 16 * 1024 * 1024;
+    const size_t num_blocks =
+        std::max(size_t(1), (mapping.nbytes() + block_size - 1) / block_size);
+    std::vector<uint64_t> block_hashes(num_blocks, 0);
+    parallel_for(0, num_blocks, [&](const size_t i) {
+        const size_t begin = std::min(i * block_size, mapping.nbytes());
+        const size_t end = std::min(begin + block_size, mapping.nbytes());
+        block_hashes[i] = hash_bytes(mapping.data() + begin, end - begin, i);
+    });
+    const uint64_t h = hash_bytes(reinterpret_cast<const uint8_t *>(block_hashes.data()),
+                                  block_hashes.size() * sizeof(uint64_t),
+                                  SCENE_CACHE_VERSION);
+
+    // The loader depends on the extension, so it's hashed along with the file contents
+    const std::string ext = get_file_extension(file);
+    return hash_bytes(reinterpret_cast<const uint8_t *>(ext.data()), ext.size(), h);
+}
+
+std::string scene_cache_file(const std::string &cache_dir, const uint64_t content_hash)
+{
+    std::stringstream ss;
+    ss << cache_dir << "/" << std::hex << content_hash << ".crtcache";
+    return ss.str();
+}
+
+class SceneCacheWriter {
+    std::ofstream &fout;
+    uint64_t offset = 0;
+    // The ids of the attribute buffers written so far, by their data and size in bytes
+    std::map<std::pair<const void *, uint64_t>, uint64_t> attribute_ids;
+
+public:
+    SceneCacheWriter(std::ofstream &fout) : fout(fout) {}
+
+    template <typename T>
+    void write(const T &val)
+    {
+        fout.write(reinterpret_cast<const char *>(&val), sizeof(T));
+        offset += sizeof(T);
+    }
+
+    // Write the array's size followed by its elements, starting at the next aligned offset
+    template <typename A>
+    void write_array(const A &arr)
+    {
+        using T = typename A::value_type;
+        write(uint64_t(arr.size()));
+        const uint64_t aligned = align_to(offset, SCENE_CACHE_ALIGNMENT);
+        const char padding[SCENE_CACHE_ALIGNMENT] = {0};
+        fout.write(padding, aligned - offset);
+        fout.write(reinterpret_cast<const char *>(arr.data()), arr.size() * sizeof(T));
+        offset = aligned + arr.size() * sizeof(T);
+    }
+
+    /* Attribute buffers shared between geometries are written once, later geometries write
+     * the id of the first copy + 1 in its place. Unshared buffers are written after a 0
+     */
+    template <typename T>
+    void write_attribute(const AttributeBuffer<T> &attrib)
+    {
+        const auto key = std::make_pair(static_cast<const void *>(attrib.data()),
+                                        uint64_t(attrib.size() * sizeof(T)));
+        auto fnd = attribute_ids.find(key);
+        if (fnd != attribute_ids.end()) {
+            write(fnd->second + 1);
+            return;
+        }
+        if (!attrib.empty()) {
+            const uint64_t id = attribute_ids.size();
+            attribute_ids[key] = id;
+        }
+        write(uint64_t(0));
+        write_array(attrib);
+    }
+
+    void write_string(const std::string &str)
+    {
+        write_array(std::vector<char>(str.begin(), str.end()));
+    }
+
+    uint64_t nbytes() const
+    {
+        return offset;
+    }
+};
+
+// Reads the scene data back from the mapped file, throwing if it reads past the end
+class SceneCacheReader {
+    std::shared_ptr<FileMapping> mapping;
+    const uint8_t *data;
+    uint64_t nbytes;
+    uint64_t offset = 0;
+
+    struct SharedAttribute {
+        const void *data;
+        uint64_t nbytes;
+        std::shared_ptr<const void> owner;
+    };
+    // The attribute buffers read so far, indexed by the ids the writer assigned them
+    std::vector<SharedAttribute> attributes;
+
+    const uint8_t *advance(const uint64_t size)
+    {
+        if (size > nbytes - offset) {
+            throw std::runtime_error("Scene cache is truncated");
+        }
+        const uint8_t *p = data + offset;
+        offset += size;
+        return p;
+    }
+
+    // Advance to the next aligned offset and return the array of size elements there
+    template <typename T>
+    const T *read_elements(const uint64_t size)
+    {
+        advance(align_to(offset, SCENE_CACHE_ALIGNMENT) - offset);
+        if (size > (nbytes - offset) / sizeof(T)) {
+            throw std::runtime_error("Scene cache is truncated");
+        }
+        return reinterpret_cast<const T *>(advance(size * sizeof(T)));
+    }
+
+public:
+    SceneCacheReader(const std::shared_ptr<FileMapping> &mapping)
+        : mapping(mapping), data(mapping->data()), nbytes(mapping->nbytes())
+    {
+    }
+
+    template <typename T>
+    T read()
+    {
+        T val;
+        std::memcpy(&val, advance(sizeof(T)), sizeof(T));
+        return val;
+    }
+
+    template <typename T>
+    void read_array(std::vector<T> &arr)
+    {
+        const uint64_t size = read<uint64_t>();
+        const T *p = read_elements<T>(size);
+        arr = std::vector<T>(p, p + size);
+    }
+
+    /* Geometry attributes reference the array in the mapped file, unless it's at the very end
+     * of the file and doesn't have AttributeBuffer's padding, in which case it's copied into
+     * a padded buffer. Attributes referencing an earlier attribute share its buffer
+     */
+    template <typename T>
+    void read_attribute(AttributeBuffer<T> &attrib)
+    {
+        const uint64_t ref = read<uint64_t>();
+        if (ref != 0) {
+            if (ref > attributes.size() || attributes[ref - 1].nbytes % sizeof(T) != 0) {
+                throw std::runtime_error("Invalid shared attribute in scene cache");
+            }
+            const SharedAttribute &a = attributes[ref - 1];
+            attrib = AttributeBuffer<T>(
+                static_cast<const T *>(a.data), a.nbytes / sizeof(T), a.owner);
+            return;
+        }
+
+        const uint64_t size = read<uint64_t>();
+        const T *p = read_elements<T>(size);
+        if (size == 0) {
+            attrib = AttributeBuffer<T>();
+            return;
+        }
+        if (nbytes - offset >= 16) {
+            attrib = AttributeBuffer<T>(p, size, mapping);
+        } else {
+            const size_t padding = (16 + sizeof(T) - 1) / sizeof(T);
+            auto copy = std::make_shared<std::vector<T>>(size + padding);
+            std::copy(p, p + size, copy->begin());
+            attrib = AttributeBuffer<T>(copy->data(), size, copy);
+        }
+        attributes.push_back(SharedAttribute{attrib.data(), size * sizeof(T), attrib.owner()});
+    }
+
+    std::string read_string()
+    {
+        std::vector<char> str;
+        read_array(str);
+        return std::string(str.begin(), str.end());
+    }
+};
+
+static void write_instances(SceneCacheWriter &writer, const std::vector<Instance> &instances)
+{
+    writer.write(uint64_t(instances.size()));
+    for (const auto &i : instances) {
+        writer.write(i.transform);
+        writer.write(uint64_t(i.parameterized_mesh_id));
+    }
+}
+
+static void read_instances(SceneCacheReader &reader, std::vector<Instance> &instances)
+{
+    instances.resize(reader.read<uint64_t>());
+    for (auto &i : instances) {
+        i.transform = reader.read<glm::mat4>();
+        i.parameterized_mesh_id = reader.read<uint64_t>();
+    }
+}
+
+static void write_group_instances(SceneCacheWriter &writer,
+                                  const std::vector<GroupInstance> &instances)
+{
+    writer.write(uint64_t(instances.size()));
+    for (const auto &i : instances) {
+        writer.write(i.transform);
+        writer.write(uint64_t(i.group_id));
+    }
+}
+
+static void read_group_instances(SceneCacheReader &reader,
+                                 std::vector<GroupInstance> &instances)
+{
+    instances.resize(reader.read<uint64_t>());
+    for (auto &i : instances) {
+        i.transform = reader.read<glm::mat4>();
+        i.group_id = reader.read<uint64_t>();
+    }
+}
+
+bool load_scene_cache(const std::string &cache_file,
+                      const uint64_t content_hash,
+                      Scene &scene)
+{
+    if (!std::ifstream(cache_file)) {
+        return false;
+    }
+    try {
+        auto mapping = std::make_shared<FileMapping>(cache_file);
+        SceneCacheReader reader(mapping);
+        const SceneCacheHeader header = reader.read<SceneCacheHeader>();
+        if (std::memcmp(header.magic, SCENE_CACHE_MAGIC, sizeof(SCENE_CACHE_MAGIC)) != 0 ||
+            header.version != SCENE_CACHE_VERSION || header.content_hash != content_hash ||
+            header.nbytes != mapping->nbytes()) {
+            std::cout << "Scene cache " << cache_file << " is out of date\n";
+            return false;
+        }
+
+        scene.meshes.resize(reader.read<uint64_t>());
+        for (auto &m : scene.meshes) {
+            m.geometries.resize(reader.read<uint64_t>());
+            for (auto &g : m.geometries) {
+                reader.read_attribute(g.vertices);
+                reader.read_attribute(g.normals);
+                reader.read_attribute(g.uvs);
+                reader.read_attribute(g.indices);
+                g.grid_dims = reader.read<glm::uvec2>();
+            }
+        }
+
+        scene.parameterized_meshes.resize(reader.read<uint64_t>());
+        for (auto &pm : scene.parameterized_meshes) {
+            pm.mesh_id = reader.read<uint64_t>();
+            reader.read_array(pm.material_ids);
+        }
+
+        read_instances(reader, scene.instances);
+        scene.instance_groups.resize(reader.read<uint64_t>());
+        for (auto &g : scene.instance_groups) {
+            read_instances(reader, g.instances);
+            read_group_instances(reader, g.group_instances);
+        }
+        read_group_instances(reader, scene.group_instances);
+
+        reader.read_array(scene.materials);
+        scene.textures.resize(reader.read<uint64_t>());
+        for (auto &t : scene.textures) {
+            t.name = reader.read_string();
+            t.width = reader.read<int32_t>();
+            t.height = reader.read<int32_t>();
+            t.channels = reader.read<int32_t>();
+            t.color_space = ColorSpace(reader.read<int32_t>());
+            reader.read_array(t.img);
+        }
+        reader.read_array(scene.lights);
+        reader.read_array(scene.cameras);
+    } catch (const std::exception &e) {
+        std::cout << "Failed to load scene cache " << cache_file << ": " << e.what() << "\n";
+        scene = Scene();
+        return false;
+    }
+    return true;
+}
+
+void save_scene_cache(const std::string &cache_file,
+                      const uint64_t content_hash,
+                      const Scene &scene)
+{
+    // Each writer gets its own temporary file, in case several runs are caching the scene
+    std::stringstream ss;
+    ss << cache_file << "." << std::hex << std::random_device()() << ".tmp";
+    const std::string tmp_file = ss.str();
+    {
+        std::ofstream fout(tmp_file, std::ios::binary);
+        if (!fout) {
+            std::cout << "Failed to open scene cache " << tmp_file << " for writing\n";
+            return;
+        }
+        SceneCacheWriter writer(fout);
+        SceneCacheHeader header = {};
+        std::memcpy(header.magic, SCENE_CACHE_MAGIC, sizeof(SCENE_CACHE_MAGIC));
+        header.version = SCENE_CACHE_VERSION;
+        header.content_hash = content_hash;
+        // The size is filled in once the rest of the file is written
+        writer.write(header);
+
+        writer.write(uint64_t(scene.meshes.size()));
+        for (const auto &m : scene.meshes) {
+            writer.write(uint64_t(m.geometries.size()));
+            for (const auto &g : m.geometries) {
+                writer.write_attribute(g.vertices);
+                writer.write_attribute(g.normals);
+                writer.write_attribute(g.uvs);
+                writer.write_attribute(g.indices);
+                writer.write(g.grid_dims);
+            }
+        }
+
+        writer.write(uint64_t(scene.parameterized_meshes.size()));
+        for (const auto &pm : scene.parameterized_meshes) {
+            writer.write(uint64_t(pm.mesh_id));
+            writer.write_array(pm.material_ids);
+        }
+
+        write_instances(writer, scene.instances);
+        writer.write(uint64_t(scene.instance_groups.size()));
+        for (const auto &g : scene.instance_groups) {
+            write_instances(writer, g.instances);
+            write_group_instances(writer, g.group_instances);
+        }
+        write_group_instances(writer, scene.group_instances);
+
+        writer.write_array(scene.materials);
+        writer.write(uint64_t(scene.textures.size()));
+        for (const auto &t : scene.textures) {
+            writer.write_string(t.name);
+            writer.write(int32_t(t.width));
+            writer.write(int32_t(t.height));
+            writer.write(int32_t(t.channels));
+            writer.write(int32_t(t.color_space));
+            writer.write_array(t.img);
+        }
+        writer.write_array(scene.lights);
+        writer.write_array(scene.cameras);
+
+        header.nbytes = writer.nbytes();
+        fout.seekp(0);
+        fout.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        if (!fout) {
+            std::cout << "Failed to write scene cache " << tmp_file << "\n";
+            fout.close();
+            std::remove(tmp_file.c_str());
+            return;
+        }
+    }
+
+    // Renaming over an existing file fails on Windows, in which case another run has
+    // already written the same cache
+    if (std::rename(tmp_file.c_str(), cache_file.c_str()) != 0) {
+        std::remove(tmp_file.c_str());
+    } else {
+        std::cout << "Saved scene cache " << cache_file << "\n";
+    }
+}
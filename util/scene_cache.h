@@ -0,0 +1,37 @@
+#pragma once
+
+#include <string>
+#include "scene.h"
+
+/* Loaded scenes can be cached in a binary file holding the geometries, parameterized
+ * meshes, instances, materials, decoded textures, lights and cameras, so that later runs
+ * on the same scene skip parsing the scene file and decoding its textures. Each array in
+ * the file is aligned to 64 bytes. The geometry attributes reference the memory mapped file
+ * in place, and the other arrays are copied out of it in bulk. Attribute buffers shared
+ * between geometries are stored once, and are shared again when the cache is loaded.
+ *
+ * Cache files are keyed by a hash of the scene file's contents, so an edited scene file gets
+ * a new cache. Files the scene references (OBJ material libraries, textures, PBRT includes)
+ * are not part of the hash, and the cache directory must be cleared if they change.
+ */
+
+// Hash the contents and type of the scene file, reading it in parallel from a file mapping
+uint64_t hash_scene_file(const std::string &file);
+
+// Get the path of the cache file for the scene content hash in the cache directory
+std::string scene_cache_file(const std::string &cache_dir, const uint64_t content_hash);
+
+/* Load the scene from the cache file, returning false if there's no valid cache for
+ * the content hash
+ */
+bool load_scene_cache(const std::string &cache_file,
+                      const uint64_t content_hash,
+                      Scene &scene);
+
+/* Write the scene to the cache file. The cache is written to a temporary file which then
+ * replaces the cache file, so that concurrent runs on the same scene never read a partially
+ * written cache
+ */
+void save_scene_cache(const std::string &cache_file,
+                      const uint64_t content_hash,
+                      const Scene &scene);
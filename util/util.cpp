@@ -1,10 +1,27 @@
 #include <algorithm>
 #include <array>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <utility>
+#include <vector>
 #ifdef _WIN32
 #include <intrin.h>
-#elif not defined(__aarch64__)
+#include <windows.h>
+#else
+#if not defined(__aarch64__)
 #include <cpuid.h>
 #endif
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#endif
+#endif
 #include "util.h"
 #include <glm/ext.hpp>
 
@@ -40,6 +57,47 @@ uint64_t align_to(uint64_t val, uint64_t align)
     return ((val + align - 1) / align) * align;
 }
 
+// Spread the low 10 bits of x out to every third bit
+static uint32_t spread_bits3(uint32_t x)
+{
+    x &= 0x3ff;
+    x = (x | (x << 16)) & 0x30000ff;
+    x = (x | (x << 8)) & 0x300f00f;
+    x = (x | (x << 4)) & 0x30c30c3;
+    x = (x | (x << 2)) & 0x9249249;
+    return x;
+}
+
+uint32_t morton_code3(const glm::uvec3 &p)
+{
+    return spread_bits3(p.x) | (spread_bits3(p.y) << 1) | (spread_bits3(p.z) << 2);
+}
+
+static uint64_t mix_hash(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+uint64_t hash_bytes(const void *bytes, const size_t nbytes, uint64_t h)
+{
+    const uint8_t *data = reinterpret_cast<const uint8_t *>(bytes);
+    size_t i = 0;
+    for (; i + sizeof(uint64_t) <= nbytes; i += sizeof(uint64_t)) {
+        uint64_t w;
+        std::memcpy(&w, data + i, sizeof(uint64_t));
+        h = (h ^ w) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    uint64_t w = 0;
+    std::memcpy(&w, data + i, nbytes - i);
+    return mix_hash(h ^ w ^ nbytes);
+}
+
 void ortho_basis(glm::vec3 &v_x, glm::vec3 &v_y, const glm::vec3 &n)
 {
     v_y = glm::vec3(0);
@@ -99,6 +157,255 @@ std::string get_cpu_brand()
 #endif
 }
 
+#if not defined(__aarch64__)
+static std::array<uint32_t, 4> cpuid(const uint32_t leaf, const uint32_t subleaf = 0)
+{
+    std::array<uint32_t, 4> regs = {0, 0, 0, 0};
+#ifdef _WIN32
+    __cpuidex(reinterpret_cast<int *>(regs.data()), leaf, subleaf);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+    return regs;
+}
+
+// Read the XCR0 register, which holds the register state the OS saves on context switches
+static uint64_t xgetbv0()
+{
+#ifdef _WIN32
+    return _xgetbv(0);
+#else
+    uint32_t eax = 0;
+    uint32_t edx = 0;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return (uint64_t(edx) << 32) | eax;
+#endif
+}
+#endif
+
+static std::string get_cpu_isa()
+{
+#if defined(__aarch64__)
+    return "NEON";
+#else
+    // The AVX ISAs can only be used if the OS saves the YMM and, for AVX-512, the opmask and
+    // ZMM registers, which may be disabled even when the CPU supports them
+    const auto features = cpuid(1);
+    const bool osxsave = features[2] & (1 << 27);
+    const uint64_t xcr0 = osxsave ? xgetbv0() : 0;
+    const bool os_avx = (xcr0 & 0x6) == 0x6;
+    const bool os_avx512 = (xcr0 & 0xe6) == 0xe6;
+
+    const uint32_t max_leaf = cpuid(0)[0];
+    if (max_leaf >= 7) {
+        const auto ext_features = cpuid(7);
+        if (os_avx512 && (ext_features[1] & (1 << 16))) {
+            return "AVX-512";
+        }
+        if (os_avx && (ext_features[1] & (1 << 5))) {
+            return "AVX2";
+        }
+    }
+    if (os_avx && (features[2] & (1 << 28))) {
+        return "AVX";
+    }
+    if (features[2] & (1 << 20)) {
+        return "SSE4.2";
+    }
+    return "SSE2";
+#endif
+}
+
+#if !defined(_WIN32) && !defined(__APPLE__)
+static std::string read_sysfs(const std::string &path)
+{
+    std::ifstream fin(path);
+    std::string line;
+    std::getline(fin, line);
+    return line;
+}
+
+// Parse a list of ranges in the sysfs format, e.g. 0-15,32-47
+static std::vector<uint32_t> parse_sysfs_list(const std::string &list)
+{
+    std::vector<uint32_t> values;
+    std::stringstream ss(list);
+    std::string range;
+    while (std::getline(ss, range, ',')) {
+        const size_t dash = range.find('-');
+        const uint32_t first = std::stoul(range.substr(0, dash));
+        const uint32_t last =
+            dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+        for (uint32_t v = first; v <= last; ++v) {
+            values.push_back(v);
+        }
+    }
+    return values;
+}
+
+// Parse cache sizes in the form "32K" or "1024K"
+static uint64_t parse_cache_size(const std::string &size)
+{
+    if (size.empty()) {
+        return 0;
+    }
+    uint64_t bytes = std::stoull(size);
+    if (size.back() == 'K') {
+        bytes *= 1024;
+    } else if (size.back() == 'M') {
+        bytes *= 1024 * 1024;
+    }
+    return bytes;
+}
+#endif
+
+bool CPUTopology::smt() const
+{
+    return logical_cores > physical_cores;
+}
+
+std::string CPUTopology::to_string() const
+{
+    std::stringstream ss;
+    ss << brand << " (" << isa << "): " << physical_cores << " cores, " << logical_cores
+       << " threads" << (smt() ? " (SMT)" : "") << ", " << numa_nodes.size() << " NUMA node"
+       << (numa_nodes.size() > 1 ? "s" : "");
+    const std::array<std::string, 3> cache_names = {"L1d", "L2", "L3"};
+    for (size_t i = 0; i < cache_sizes.size(); ++i) {
+        if (cache_sizes[i] != 0) {
+            ss << ", " << cache_names[i] << " " << cache_sizes[i] / 1024 << "KB";
+        }
+    }
+    return ss.str();
+}
+
+CPUTopology get_cpu_topology()
+{
+    CPUTopology topology;
+    topology.brand = get_cpu_brand();
+    topology.isa = get_cpu_isa();
+    topology.logical_cores = std::thread::hardware_concurrency();
+    topology.physical_cores = topology.logical_cores;
+
+#if defined(_WIN32)
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+    using ProcessorInfo = SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX;
+    std::vector<uint8_t> buf(length);
+    if (GetLogicalProcessorInformationEx(
+            RelationAll, reinterpret_cast<ProcessorInfo *>(buf.data()), &length)) {
+        topology.physical_cores = 0;
+        for (DWORD offset = 0; offset < length;) {
+            const auto *info = reinterpret_cast<ProcessorInfo *>(&buf[offset]);
+            if (info->Relationship == RelationProcessorCore) {
+                ++topology.physical_cores;
+            } else if (info->Relationship == RelationNumaNode) {
+                // Only the cores in the first processor group can be used for affinity
+                std::vector<uint32_t> cores;
+                if (info->NumaNode.GroupMask.Group == 0) {
+                    for (uint32_t i = 0; i < sizeof(KAFFINITY) * 8; ++i) {
+                        if (info->NumaNode.GroupMask.Mask & (KAFFINITY(1) << i)) {
+                            cores.push_back(i);
+                        }
+                    }
+                }
+                topology.numa_nodes.push_back(cores);
+            } else if (info->Relationship == RelationCache) {
+                const auto &cache = info->Cache;
+                if (cache.Level >= 1 && cache.Level <= 3 &&
+                    (cache.Type == CacheData || cache.Type == CacheUnified)) {
+                    topology.cache_sizes[cache.Level - 1] = cache.CacheSize;
+                }
+            }
+            offset += info->Size;
+        }
+    }
+#elif defined(__APPLE__)
+    auto query_sysctl = [](const char *name) {
+        uint64_t value = 0;
+        size_t size = sizeof(value);
+        if (sysctlbyname(name, &value, &size, nullptr, 0) != 0) {
+            return uint64_t(0);
+        }
+        return value;
+    };
+    topology.physical_cores = query_sysctl("hw.physicalcpu");
+    topology.logical_cores = query_sysctl("hw.logicalcpu");
+    topology.cache_sizes[0] = query_sysctl("hw.l1dcachesize");
+    topology.cache_sizes[1] = query_sysctl("hw.l2cachesize");
+    topology.cache_sizes[2] = query_sysctl("hw.l3cachesize");
+#else
+    const std::string cpu_dir = "/sys/devices/system/cpu/cpu";
+    std::set<std::pair<std::string, std::string>> cores;
+    for (uint32_t i = 0; i < topology.logical_cores; ++i) {
+        const std::string topo_dir = cpu_dir + std::to_string(i) + "/topology/";
+        const std::string package = read_sysfs(topo_dir + "physical_package_id");
+        const std::string core = read_sysfs(topo_dir + "core_id");
+        if (!core.empty()) {
+            cores.insert(std::make_pair(package, core));
+        }
+    }
+    if (!cores.empty()) {
+        topology.physical_cores = cores.size();
+    }
+
+    for (uint32_t i = 0;; ++i) {
+        const std::string cache_dir = cpu_dir + "0/cache/index" + std::to_string(i) + "/";
+        const std::string level = read_sysfs(cache_dir + "level");
+        if (level.empty()) {
+            break;
+        }
+        const int l = std::stoi(level);
+        const std::string type = read_sysfs(cache_dir + "type");
+        if (l >= 1 && l <= 3 && (type == "Data" || type == "Unified")) {
+            topology.cache_sizes[l - 1] = parse_cache_size(read_sysfs(cache_dir + "size"));
+        }
+    }
+
+    // The online node ids can have gaps, and memory-only nodes (e.g., CXL or HBM memory) have
+    // no cores, so they're skipped
+    const std::string node_dir = "/sys/devices/system/node/";
+    for (const uint32_t node : parse_sysfs_list(read_sysfs(node_dir + "online"))) {
+        const std::string cpulist =
+            read_sysfs(node_dir + "node" + std::to_string(node) + "/cpulist");
+        if (!cpulist.empty()) {
+            topology.numa_nodes.push_back(parse_sysfs_list(cpulist));
+        }
+    }
+#endif
+    // If we couldn't find the NUMA nodes treat the system as a single node
+    if (topology.numa_nodes.empty()) {
+        std::vector<uint32_t> cores(topology.logical_cores);
+        std::iota(cores.begin(), cores.end(), 0);
+        topology.numa_nodes.push_back(cores);
+    }
+    return topology;
+}
+
+bool set_thread_affinity(const std::vector<uint32_t> &cores)
+{
+#if defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (const auto &c : cores) {
+        if (c < sizeof(DWORD_PTR) * 8) {
+            mask |= DWORD_PTR(1) << c;
+        }
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#elif defined(__APPLE__)
+    // macOS doesn't support pinning threads to cores
+    (void)cores;
+    return false;
+#else
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (const auto &c : cores) {
+        CPU_SET(c, &cpus);
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus) == 0;
+#endif
+}
+
 float srgb_to_linear(float x)
 {
     if (x <= 0.04045f) {
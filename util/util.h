@@ -1,6 +1,14 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <exception>
+#include <iterator>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <vector>
 #include <glm/glm.hpp>
 
 // Format the count as #G, #M, #K, depending on its magnitude
@@ -8,6 +16,13 @@ std::string pretty_print_count(const double count);
 
 uint64_t align_to(uint64_t val, uint64_t align);
 
+// Interleave the low 10 bits of each component into a 30-bit 3D Morton code
+uint32_t morton_code3(const glm::uvec3 &p);
+
+// Hash the bytes, seeded with h. This is a fast non-cryptographic hash, used to identify
+// scene files and duplicate scene data
+uint64_t hash_bytes(const void *bytes, const size_t nbytes, uint64_t h);
+
 void ortho_basis(glm::vec3 &v_x, glm::vec3 &v_y, const glm::vec3 &n);
 
 void canonicalize_path(std::string &path);
@@ -16,8 +31,112 @@ std::string get_file_extension(const std::string &fname);
 
 std::string get_cpu_brand();
 
+/* A summary of the CPU cores, caches and NUMA nodes of the system. Values which can't be
+ * queried on the platform are left at 0
+ */
+struct CPUTopology {
+    std::string brand;
+    // The widest vector ISA supported, e.g. AVX2 or NEON
+    std::string isa;
+    uint32_t logical_cores = 0;
+    uint32_t physical_cores = 0;
+    // The logical cores in each NUMA node
+    std::vector<std::vector<uint32_t>> numa_nodes;
+    // Sizes in bytes of the L1 data, L2 and L3 caches
+    std::array<uint64_t, 3> cache_sizes = {0, 0, 0};
+
+    bool smt() const;
+
+    std::string to_string() const;
+};
+
+CPUTopology get_cpu_topology();
+
+// Restrict the calling thread to run on the logical cores, returns false if this isn't
+// supported
+bool set_thread_affinity(const std::vector<uint32_t> &cores);
+
 float srgb_to_linear(const float x);
 
 float linear_to_srgb(const float x);
 
 float luminance(const glm::vec3 &c);
+
+/* Run f(i) for each i in [begin, end) on the hardware threads, with the threads taking
+ * the next index as they finish. The first exception thrown by f is rethrown once all
+ * threads have finished
+ */
+template <typename F>
+void parallel_for(const size_t begin, const size_t end, const F &f)
+{
+    if (begin >= end) {
+        return;
+    }
+    const size_t num_threads = std::min(
+        end - begin, size_t(std::max(std::thread::hardware_concurrency(), 1u)));
+
+    std::atomic<size_t> next(begin);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto run = [&]() {
+        try {
+            for (size_t i = next++; i < end; i = next++) {
+                f(i);
+            }
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            next = end;
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < num_threads; ++i) {
+        threads.emplace_back(run);
+    }
+    run();
+    for (auto &t : threads) {
+        t.join();
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+/* Sort [begin, end) by comp, sorting chunks of the range in parallel and then merging them
+ * in parallel rounds. Small ranges are sorted with std::sort. The sort isn't stable
+ */
+template <typename It, typename Compare>
+void parallel_sort(It begin, It end, const Compare &comp)
+{
+    const size_t min_chunk_size = 64 * 1024;
+    const size_t n = std::distance(begin, end);
+    const size_t num_chunks =
+        std::min(n / min_chunk_size,
+                 size_t(std::max(std::thread::hardware_concurrency(), 1u)));
+    if (num_chunks < 2) {
+        std::sort(begin, end, comp);
+        return;
+    }
+
+    std::vector<size_t> bounds(num_chunks + 1);
+    for (size_t i = 0; i <= num_chunks; ++i) {
+        bounds[i] = n * i / num_chunks;
+    }
+    parallel_for(0, num_chunks, [&](const size_t i) {
+        std::sort(begin + bounds[i], begin + bounds[i + 1], comp);
+    });
+    for (size_t width = 1; width < num_chunks; width *= 2) {
+        parallel_for(0, (num_chunks + 2 * width - 1) / (2 * width), [&](const size_t i) {
+            const size_t lo = 2 * width * i;
+            const size_t mid = std::min(lo + width, num_chunks);
+            const size_t hi = std::min(lo + 2 * width, num_chunks);
+            if (mid < hi) {
+                std::inplace_merge(
+                    begin + bounds[lo], begin + bounds[mid], begin + bounds[hi], comp);
+            }
+        });
+    }
+}